@@ -0,0 +1,288 @@
+/*
+ * LPC11Exx.h
+ *
+ * Register model of the LPC11Exx blocks used by the firmware, so that
+ * src/main.c can be built unchanged for the host simulator (see sim.c).
+ *
+ * Peripherals are plain structures in host memory. Every access through
+ * one of the LPC_* or SCB pointers first calls SimCommit(), which applies
+ * the side effects of the writes made since the previous access (shifting
+ * out SSP0 words, toggling GPIO pins, restarting CT32B0, etc.). Reads
+ * leave no trace, so accesses to SSP1 are also counted to tell when a word
+ * of its receive FIFO has been read from DR (see SimAccessSSP1). SysTick
+ * counts down at the simulated core clock, which stands still while
+ * firmware code runs.
+ */
+
+#ifndef LPC11EXX_H_
+#define LPC11EXX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __I
+#define __I     volatile const
+#endif
+#define __O     volatile
+#define __IO    volatile
+
+typedef enum IRQn {
+    NonMaskableInt_IRQn     = -14,
+    HardFault_IRQn          = -13,
+    SVCall_IRQn             = -5,
+    PendSV_IRQn             = -2,
+    SysTick_IRQn            = -1,
+
+    FLEX_INT0_IRQn          = 0,
+    FLEX_INT1_IRQn          = 1,
+    FLEX_INT2_IRQn          = 2,
+    FLEX_INT3_IRQn          = 3,
+    FLEX_INT4_IRQn          = 4,
+    FLEX_INT5_IRQn          = 5,
+    FLEX_INT6_IRQn          = 6,
+    FLEX_INT7_IRQn          = 7,
+    GINT0_IRQn              = 8,
+    GINT1_IRQn              = 9,
+    SSP1_IRQn               = 14,
+    I2C_IRQn                = 15,
+    TIMER_16_0_IRQn         = 16,
+    TIMER_16_1_IRQn         = 17,
+    TIMER_32_0_IRQn         = 18,
+    TIMER_32_1_IRQn         = 19,
+    SSP0_IRQn               = 20,
+    UART_IRQn               = 21,
+    ADC_IRQn                = 24,
+    WDT_IRQn                = 25,
+    BOD_IRQn                = 26,
+    FMC_IRQn                = 27
+} IRQn_Type;
+
+typedef struct {
+    __IO uint32_t SYSMEMREMAP;
+    __IO uint32_t PRESETCTRL;
+    __IO uint32_t SYSPLLCTRL;
+    __I  uint32_t SYSPLLSTAT;
+    __IO uint32_t SYSOSCCTRL;
+    __IO uint32_t WDTOSCCTRL;
+    __IO uint32_t SYSRSTSTAT;
+    __IO uint32_t SYSPLLCLKSEL;
+    __IO uint32_t SYSPLLCLKUEN;
+    __IO uint32_t MAINCLKSEL;
+    __IO uint32_t MAINCLKUEN;
+    __IO uint32_t SYSAHBCLKDIV;
+    __IO uint32_t SYSAHBCLKCTRL;
+    __IO uint32_t SSP0CLKDIV;
+    __IO uint32_t UARTCLKDIV;
+    __IO uint32_t SSP1CLKDIV;
+    __IO uint32_t CLKOUTSEL;
+    __IO uint32_t CLKOUTUEN;
+    __IO uint32_t CLKOUTDIV;
+    __I  uint32_t PIOPORCAP0;
+    __I  uint32_t PIOPORCAP1;
+    __IO uint32_t BODCTRL;
+    __IO uint32_t SYSTCKCAL;
+    __IO uint32_t IRQLATENCY;
+    __IO uint32_t NMISRC;
+    __IO uint32_t PINTSEL[8];
+    __IO uint32_t STARTERP0;
+    __IO uint32_t STARTERP1;
+    __IO uint32_t PDSLEEPCFG;
+    __IO uint32_t PDAWAKECFG;
+    __IO uint32_t PDRUNCFG;
+    __I  uint32_t DEVICE_ID;
+} LPC_SYSCON_Type;
+
+typedef struct {
+    __IO uint32_t RESET_PIO0_0;
+    __IO uint32_t PIO0_1;
+    __IO uint32_t PIO0_2;
+    __IO uint32_t PIO0_3;
+    __IO uint32_t PIO0_4;
+    __IO uint32_t PIO0_5;
+    __IO uint32_t PIO0_6;
+    __IO uint32_t PIO0_7;
+    __IO uint32_t PIO0_8;
+    __IO uint32_t PIO0_9;
+    __IO uint32_t SWCLK_PIO0_10;
+    __IO uint32_t TDI_PIO0_11;
+    __IO uint32_t TMS_PIO0_12;
+    __IO uint32_t TDO_PIO0_13;
+    __IO uint32_t TRST_PIO0_14;
+    __IO uint32_t SWDIO_PIO0_15;
+    __IO uint32_t PIO0_16;
+    __IO uint32_t PIO0_17;
+    __IO uint32_t PIO0_18;
+    __IO uint32_t PIO0_19;
+    __IO uint32_t PIO0_20;
+    __IO uint32_t PIO0_21;
+    __IO uint32_t PIO0_22;
+    __IO uint32_t PIO0_23;
+    __IO uint32_t PIO1_0;
+    __IO uint32_t PIO1_1;
+    __IO uint32_t PIO1_2;
+    __IO uint32_t PIO1_3;
+    __IO uint32_t PIO1_4;
+    __IO uint32_t PIO1_5;
+    __IO uint32_t PIO1_6;
+    __IO uint32_t PIO1_7;
+    __IO uint32_t PIO1_8;
+    __IO uint32_t PIO1_9;
+    __IO uint32_t PIO1_10;
+    __IO uint32_t PIO1_11;
+    __IO uint32_t PIO1_12;
+    __IO uint32_t PIO1_13;
+    __IO uint32_t PIO1_14;
+    __IO uint32_t PIO1_15;
+    __IO uint32_t PIO1_16;
+    __IO uint32_t PIO1_17;
+    __IO uint32_t PIO1_18;
+    __IO uint32_t PIO1_19;
+    __IO uint32_t PIO1_20;
+    __IO uint32_t PIO1_21;
+    __IO uint32_t PIO1_22;
+    __IO uint32_t PIO1_23;
+    __IO uint32_t PIO1_24;
+    __IO uint32_t PIO1_25;
+    __IO uint32_t PIO1_26;
+    __IO uint32_t PIO1_27;
+    __IO uint32_t PIO1_28;
+    __IO uint32_t PIO1_29;
+    __IO uint32_t PIO1_30;
+    __IO uint32_t PIO1_31;
+} LPC_IOCON_Type;
+
+typedef struct {
+    union {
+        struct {
+            __IO uint8_t B0[32];
+            __IO uint8_t B1[32];
+        };
+        __IO uint8_t B[64];
+    };
+    union {
+        struct {
+            __IO uint32_t W0[32];
+            __IO uint32_t W1[32];
+        };
+        __IO uint32_t W[64];
+    };
+    __IO uint32_t DIR[2];
+    __IO uint32_t MASK[2];
+    __IO uint32_t PIN[2];
+    __IO uint32_t MPIN[2];
+    __IO uint32_t SET[2];
+    __O  uint32_t CLR[2];
+    __O  uint32_t NOT[2];
+} LPC_GPIO_Type;
+
+typedef struct {
+    __IO uint32_t CR0;
+    __IO uint32_t CR1;
+    __IO uint32_t DR;
+    __I  uint32_t SR;
+    __IO uint32_t CPSR;
+    __IO uint32_t IMSC;
+    __I  uint32_t RIS;
+    __I  uint32_t MIS;
+    __O  uint32_t ICR;
+} LPC_SSPx_Type;
+
+typedef struct {
+    __IO uint32_t IR;
+    __IO uint32_t TCR;
+    __IO uint32_t TC;
+    __IO uint32_t PR;
+    __IO uint32_t PC;
+    __IO uint32_t MCR;
+    __IO uint32_t MR0;
+    __IO uint32_t MR1;
+    __IO uint32_t MR2;
+    __IO uint32_t MR3;
+    __IO uint32_t CCR;
+    __I  uint32_t CR0;
+    __I  uint32_t CR1;
+    __IO uint32_t EMR;
+    __IO uint32_t CTCR;
+    __IO uint32_t PWMC;
+} LPC_CTxxBx_Type;
+
+typedef struct {
+    __I  uint32_t CPUID;
+    __IO uint32_t ICSR;
+    __IO uint32_t VTOR;
+    __IO uint32_t AIRCR;
+    __IO uint32_t SCR;
+    __IO uint32_t CCR;
+    __IO uint32_t SHP[2];
+    __IO uint32_t SHCSR;
+} SCB_Type;
+
+typedef struct {
+    __IO uint32_t CTRL;
+    __IO uint32_t LOAD;
+    __IO uint32_t VAL;
+    __I  uint32_t CALIB;
+} SysTick_Type;
+
+#define SysTick_CTRL_COUNTFLAG_Msk  (1UL << 16)
+#define SysTick_CTRL_CLKSOURCE_Msk  (1UL << 2)
+#define SysTick_CTRL_TICKINT_Msk    (1UL << 1)
+#define SysTick_CTRL_ENABLE_Msk     (1UL << 0)
+#define SysTick_LOAD_RELOAD_Msk     0xffffffUL
+#define SysTick_VAL_CURRENT_Msk     0xffffffUL
+
+#define SCB_ICSR_PENDSVSET_Msk      (1UL << 28)
+#define SCB_ICSR_PENDSVCLR_Msk      (1UL << 27)
+#define SCB_SCR_SEVONPEND_Msk       (1UL << 4)
+#define SCB_SCR_SLEEPDEEP_Msk       (1UL << 2)
+#define SCB_SCR_SLEEPONEXIT_Msk     (1UL << 1)
+
+extern LPC_SYSCON_Type  g_sim_syscon;
+extern LPC_IOCON_Type   g_sim_iocon;
+extern LPC_GPIO_Type    g_sim_gpio;
+extern LPC_SSPx_Type    g_sim_ssp0;
+extern LPC_SSPx_Type    g_sim_ssp1;
+extern LPC_CTxxBx_Type  g_sim_ct32b0;
+extern LPC_CTxxBx_Type  g_sim_ct32b1;
+extern LPC_CTxxBx_Type  g_sim_ct16b0;
+extern SCB_Type         g_sim_scb;
+extern SysTick_Type     g_sim_systick;
+
+extern uint32_t SystemCoreClock;
+
+void SimCommit(void);
+void SimAccessSSP1(void);
+
+#define LPC_SYSCON  (SimCommit(), &g_sim_syscon)
+#define LPC_IOCON   (SimCommit(), &g_sim_iocon)
+#define LPC_GPIO    (SimCommit(), &g_sim_gpio)
+#define LPC_SSP0    (SimCommit(), &g_sim_ssp0)
+#define LPC_SSP1    (SimAccessSSP1(), &g_sim_ssp1)
+#define LPC_CT32B0  (SimCommit(), &g_sim_ct32b0)
+#define LPC_CT32B1  (SimCommit(), &g_sim_ct32b1)
+#define LPC_CT16B0  (SimCommit(), &g_sim_ct16b0)
+#define SCB         (SimCommit(), &g_sim_scb)
+#define SysTick     (SimCommit(), &g_sim_systick)
+
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+uint32_t NVIC_GetPendingIRQ(IRQn_Type irq);
+void NVIC_SetPendingIRQ(IRQn_Type irq);
+void NVIC_ClearPendingIRQ(IRQn_Type irq);
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+uint32_t NVIC_GetPriority(IRQn_Type irq);
+
+void __enable_irq(void);
+void __disable_irq(void);
+void __WFI(void);
+
+#define __WFE()     __WFI()
+#define __NOP()     ((void)0)
+#define __DSB()     ((void)0)
+#define __ISB()     ((void)0)
+#define __DMB()     ((void)0)
+
+void SystemInit(void);
+void SystemCoreClockUpdate(void);
+
+#endif /* LPC11EXX_H_ */
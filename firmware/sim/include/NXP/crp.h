@@ -0,0 +1,18 @@
+/*
+ * crp.h
+ *
+ * Host simulator stand-in for the NXP code read protection header.
+ */
+
+#ifndef CRP_H_
+#define CRP_H_
+
+#define __CRP
+
+#define CRP_NO_CRP      0xFFFFFFFF
+#define NO_ISP          0x4E697370
+#define CRP1            0x12345678
+#define CRP2            0x87654321
+#define CRP3_CONSUME_PART   0x43218765
+
+#endif /* CRP_H_ */
@@ -0,0 +1,17 @@
+/*
+ * cr_section_macros.h
+ *
+ * Host simulator stand-in for the Code Red section placement macros;
+ * everything lands in the default host sections.
+ */
+
+#ifndef CR_SECTION_MACROS_H_
+#define CR_SECTION_MACROS_H_
+
+#define __DATA(bank)
+#define __BSS(bank)
+#define __RAMFUNC(bank)
+#define __NOINIT(bank)
+#define __NOINIT_DEF
+
+#endif /* CR_SECTION_MACROS_H_ */
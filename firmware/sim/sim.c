@@ -0,0 +1,1422 @@
+/*
+ * sim.c
+ *
+ * Host simulation of the tbhb board. src/main.c is built unchanged against
+ * the register model in include/LPC11Exx.h, with its main() renamed to
+ * FirmwareMain(). Host words are clocked into the SSP1 receive FIFO at the
+ * host SPI rate, the timers count off their match registers, and
+ * interrupts are taken by NVIC priority whenever the firmware waits in
+ * __WFI().
+ *
+ * Every host word, SSP0 word, CSEL change and timer interval is traced,
+ * and the on-time of every LED is rebuilt for each scan of the panel from
+ * the latched driver outputs, the row selected by CSEL and BLANK.
+ */
+
+// The simulator is the hardware, so read-only registers are writable here
+#define __I volatile
+
+#include <getopt.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "LPC11Exx.h"
+#include "defs.h"
+#include "conf.h"
+#include "host.h"
+#include "program.h"
+
+#define SIM_NEVER           UINT64_MAX
+#define SIM_EXCEPTIONS      48
+#define SIM_EXCEPTION(irq)  ((irq) + 16)
+#define SIM_PRIO_BITS       2
+#define SIM_PRIO_THREAD     (1 << SIM_PRIO_BITS)
+
+// Marks DR and IR values that were exposed by the simulator, so that
+// any value written by the firmware can be told apart from them
+#define SIM_DR_IDLE         UINT32_MAX
+#define SIM_DR_EXPOSED      (1UL << 31)
+#define SIM_IR_EXPOSED      (1UL << 31)
+
+#define SIM_SSP_FIFO        8
+#define SIM_SSP_TIMEOUT     32      // bits of idle time before RTIM
+#define SIM_CHANNELS        (LINE_WORDS * DRIVER_CHANNELS)
+#define SIM_CSEL_PINS       PROGRAM_CSEL(0, 7)
+
+int FirmwareMain(void);
+
+LPC_SYSCON_Type g_sim_syscon;
+LPC_IOCON_Type  g_sim_iocon;
+LPC_GPIO_Type   g_sim_gpio;
+LPC_SSPx_Type   g_sim_ssp0;
+LPC_SSPx_Type   g_sim_ssp1;
+LPC_CTxxBx_Type g_sim_ct32b0;
+LPC_CTxxBx_Type g_sim_ct32b1;
+LPC_CTxxBx_Type g_sim_ct16b0;
+SCB_Type        g_sim_scb;
+SysTick_Type    g_sim_systick;
+
+uint32_t SystemCoreClock = 48000000;
+
+// Core clock cycles since reset
+static uint64_t g_sim_time;
+static uint64_t g_sim_time_limit;
+
+// NVIC and core state
+static uint32_t g_sim_irq_enabled;
+static uint32_t g_sim_irq_pending;
+static bool g_sim_pendsv;
+static uint8_t g_sim_prio[SIM_EXCEPTIONS];
+static uintptr_t g_sim_exec_prio = SIM_PRIO_THREAD;
+static bool g_sim_primask;
+
+// Host transfers, in order of arrival
+typedef struct {
+    uint64_t time;
+    HOST_DATA data;
+} SimHostWord;
+
+static SimHostWord *g_sim_host;
+static size_t g_sim_host_count;
+static size_t g_sim_host_next;
+static uint64_t g_sim_host_clk = HOST_SPI_CLK;
+
+// SSP1 receive FIFO
+static HOST_DATA g_sim_rx[SIM_SSP_FIFO];
+static size_t g_sim_rx_head;
+static size_t g_sim_rx_count;
+static uint64_t g_sim_rx_time;
+static bool g_sim_rx_timeout;
+static bool g_sim_rx_overrun;
+static uintptr_t g_sim_rx_accesses; // SSP1 accesses since DR was exposed
+
+// SSP1 transmit FIFO, shifted out on MISO as host words are clocked in
+static HOST_DATA g_sim_miso[SIM_SSP_FIFO];
+static size_t g_sim_miso_head;
+static size_t g_sim_miso_count;
+
+// SSP0 words being shifted out to the drivers, latched at their end time
+typedef struct {
+    uint64_t time;
+    uint32_t data;
+} SimTxWord;
+
+static SimTxWord g_sim_tx[SIM_SSP_FIFO];
+static size_t g_sim_tx_head;
+static size_t g_sim_tx_count;
+static uint64_t g_sim_tx_end;
+static uint64_t g_sim_tx_gated = SIM_NEVER; // SSP0 clock off since then
+
+// CT32B0, CT32B1 and CT16B0 counters, as TC value at a given time
+typedef struct {
+    LPC_CTxxBx_Type *regs;
+    uint32_t tc;
+    uint64_t tc_time;
+    uint32_t tc_exposed;
+    uint32_t tcr;
+    uint32_t pr;
+    uint32_t ir;
+    uint64_t match;
+} SimTimer;
+
+enum {
+    SIM_TIMER_CT32B0,
+    SIM_TIMER_CT32B1,
+    SIM_TIMER_CT16B0,
+    SIM_TIMERS
+};
+
+static SimTimer g_sim_timers[SIM_TIMERS] = {
+    [SIM_TIMER_CT32B0] = { .regs = &g_sim_ct32b0, .match = SIM_NEVER },
+    [SIM_TIMER_CT32B1] = { .regs = &g_sim_ct32b1, .match = SIM_NEVER },
+    [SIM_TIMER_CT16B0] = { .regs = &g_sim_ct16b0, .match = SIM_NEVER },
+};
+static uint64_t g_sim_timer_irq_time;
+
+// SysTick, as VAL at a given time; it always counts the core clock and
+//  never interrupts
+static uint32_t g_sim_systick_val;
+static uint64_t g_sim_systick_time;
+static uint32_t g_sim_systick_exposed;
+
+// GPIO pin states, and the W/B register contents last exposed for them
+static uint32_t g_sim_pins[2];
+static uint32_t g_sim_gpio_w[64];
+static uint8_t g_sim_gpio_b[64];
+
+// Driver and panel state; words shift into the first driver of the chain
+//  and on to the next ones, and all of them are latched at once
+static uint32_t g_sim_chain[LINE_WORDS];
+static uint32_t g_sim_line[LINE_WORDS];
+static uintptr_t g_sim_row;
+static uintptr_t g_sim_row_line;    // Line of a frame shown in g_sim_row
+
+// Position of the driver timer in the program of a line, as intervals run
+//  and the bit depths of the profiles whose programs they still match
+static uintptr_t g_sim_program_pos;
+static uint32_t g_sim_program_depths;
+static bool g_sim_driver_running;   // Timer runs line programs
+static bool g_sim_driver_restarted; // Timer restarted by this handler
+static uint64_t g_sim_on[LINES][SIM_CHANNELS];
+static uint64_t g_sim_shown[LINES][SIM_CHANNELS];
+static uint64_t g_sim_integrated;
+static uint64_t g_sim_scan_time;
+static unsigned long g_sim_scans;
+static intptr_t g_sim_iref = -1;
+
+// Options
+static bool g_sim_trace = true;
+static bool g_sim_print_all;
+static unsigned long g_sim_tail_scans = 2;
+static unsigned long g_sim_done_scans = ULONG_MAX;
+
+// Statistics
+typedef struct {
+    unsigned long count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} SimHandlerStats;
+
+static SimHandlerStats g_sim_stats[SIM_EXCEPTIONS];
+static uintptr_t g_sim_exception;   // Exception running, 0 in thread mode
+static uint64_t g_sim_nested_ns;
+static unsigned long g_sim_host_words;
+static unsigned long g_sim_rx_overruns;
+static unsigned long g_sim_tx_words;
+static unsigned long g_sim_tx_dropped;
+
+static void
+SimDefaultHandler(void)
+{
+    fprintf(stderr, "tbhb-sim: unhandled exception at %llu\n",
+            (unsigned long long)g_sim_time);
+    abort();
+}
+
+#define SIM_WEAK_HANDLER(name) \
+    void name(void) __attribute__((weak, alias("SimDefaultHandler")))
+SIM_WEAK_HANDLER(PendSV_Handler);
+SIM_WEAK_HANDLER(SysTick_Handler);
+SIM_WEAK_HANDLER(SSP1_IRQHandler);
+SIM_WEAK_HANDLER(TIMER16_0_IRQHandler);
+SIM_WEAK_HANDLER(TIMER16_1_IRQHandler);
+SIM_WEAK_HANDLER(TIMER32_0_IRQHandler);
+SIM_WEAK_HANDLER(TIMER32_1_IRQHandler);
+SIM_WEAK_HANDLER(SSP0_IRQHandler);
+#undef SIM_WEAK_HANDLER
+
+static void (*const g_sim_vectors[SIM_EXCEPTIONS])(void) = {
+    [SIM_EXCEPTION(PendSV_IRQn)] = PendSV_Handler,
+    [SIM_EXCEPTION(SysTick_IRQn)] = SysTick_Handler,
+    [SIM_EXCEPTION(SSP1_IRQn)] = SSP1_IRQHandler,
+    [SIM_EXCEPTION(TIMER_16_0_IRQn)] = TIMER16_0_IRQHandler,
+    [SIM_EXCEPTION(TIMER_16_1_IRQn)] = TIMER16_1_IRQHandler,
+    [SIM_EXCEPTION(TIMER_32_0_IRQn)] = TIMER32_0_IRQHandler,
+    [SIM_EXCEPTION(TIMER_32_1_IRQn)] = TIMER32_1_IRQHandler,
+    [SIM_EXCEPTION(SSP0_IRQn)] = SSP0_IRQHandler,
+};
+
+static const char *const g_sim_names[SIM_EXCEPTIONS] = {
+    [SIM_EXCEPTION(PendSV_IRQn)] = "PendSV",
+    [SIM_EXCEPTION(SysTick_IRQn)] = "SysTick",
+    [SIM_EXCEPTION(SSP1_IRQn)] = "SSP1",
+    [SIM_EXCEPTION(TIMER_16_0_IRQn)] = "TIMER16_0",
+    [SIM_EXCEPTION(TIMER_16_1_IRQn)] = "TIMER16_1",
+    [SIM_EXCEPTION(TIMER_32_0_IRQn)] = "TIMER32_0",
+    [SIM_EXCEPTION(TIMER_32_1_IRQn)] = "TIMER32_1",
+    [SIM_EXCEPTION(SSP0_IRQn)] = "SSP0",
+};
+
+static uint64_t
+SimHostNanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void
+SimTrace(const char *event, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void
+SimTrace(const char *event, const char *format, ...)
+{
+    va_list args;
+    if (!g_sim_trace) {
+        return;
+    }
+    printf("%12llu %-6s ", (unsigned long long)g_sim_time, event);
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    putchar('\n');
+}
+
+static uint64_t
+SimCyclesFromMicroseconds(double us)
+{
+    return (uint64_t)(us * SystemCoreClock / 1000000 + 0.5);
+}
+
+/*
+ * Driver outputs
+ */
+
+static void
+SimIntegrate(void)
+{
+    uintptr_t i;
+    uint64_t elapsed = g_sim_time - g_sim_integrated;
+    g_sim_integrated = g_sim_time;
+    if (!elapsed || (g_sim_pins[BLANK_PORT] & (1 << BLANK_PIN))) {
+        return;
+    }
+    for (i = 0; i < SIM_CHANNELS; ++i) {
+        if (g_sim_line[i / DRIVER_CHANNELS] & (1 << (i % DRIVER_CHANNELS))) {
+            g_sim_on[g_sim_row][i] += elapsed;
+        }
+    }
+}
+
+static void
+SimEndScan(void)
+{
+    uintptr_t row, x, c;
+    bool changed = memcmp(g_sim_on, g_sim_shown, sizeof(g_sim_on)) != 0;
+
+    if (changed || g_sim_print_all) {
+        printf("%12llu SCAN   %lu %llu\n", (unsigned long long)g_sim_time,
+                g_sim_scans,
+                (unsigned long long)(g_sim_time - g_sim_scan_time));
+        for (row = 0; row < LINES; ++row) {
+            printf("%12llu ROW    %lu", (unsigned long long)g_sim_time,
+                    (unsigned long)row);
+            for (x = 0; x < WIDTH; ++x) {
+                // Red, green and blue from the first channel of a pixel
+                const uint64_t *on = &g_sim_on[row][PIXEL_CHANNEL(x)];
+                printf(" %6llu", (unsigned long long)on[0]);
+                for (c = 1; c < CHANNELS - 1; ++c) {
+                    printf("/%llu", (unsigned long long)on[c]);
+                }
+                printf("/%-6llu", (unsigned long long)on[CHANNELS - 1]);
+            }
+            putchar('\n');
+        }
+    }
+    memcpy(g_sim_shown, g_sim_on, sizeof(g_sim_on));
+    memset(g_sim_on, 0, sizeof(g_sim_on));
+    g_sim_scan_time = g_sim_time;
+    g_sim_scans++;
+}
+
+static uintptr_t
+SimLineOfPins(uint32_t pins)
+{
+    uintptr_t line = 0;
+    while (PROGRAM_CSEL_LINE[line] != (pins & SIM_CSEL_PINS)) {
+        ++line;
+    }
+    return line;
+}
+
+static void
+SimSetPins(uintptr_t port, uint32_t pins)
+{
+    uint32_t changed = g_sim_pins[port] ^ pins;
+    if (!changed) {
+        return;
+    }
+    SimIntegrate();
+    g_sim_pins[port] = pins;
+
+    if (port == CSEL0_PORT && (changed & SIM_CSEL_PINS)) {
+        g_sim_row = (!!(pins & (1 << CSEL0_PIN))) |
+                ((!!(pins & (1 << CSEL1_PIN))) << 1) |
+                ((!!(pins & (1 << CSEL2_PIN))) << 2);
+        SimTrace("CSEL", "%lu", (unsigned long)g_sim_row);
+    }
+    if (port == BLANK_PORT && (changed & (1 << BLANK_PIN))) {
+        SimTrace("BLANK", "%d", !!(pins & (1 << BLANK_PIN)));
+    }
+    if (port == SPI_EN_PORT && (changed & (1 << SPI_EN_PIN))) {
+        SimTrace("EN", "%d", !!(pins & (1 << SPI_EN_PIN)));
+    }
+}
+
+static void
+SimStartLine(bool scanning)
+{
+    // Lines left out of the scan are skipped, so a scan ends whenever the
+    //  driver starts a line at or before the one it showed last, which
+    //  with a single line is every line
+    uintptr_t line = SimLineOfPins(g_sim_pins[CSEL0_PORT]);
+    SimIntegrate();
+    if (scanning && line <= g_sim_row_line && g_sim_time != g_sim_scan_time) {
+        SimEndScan();
+    }
+    g_sim_row_line = line;
+    g_sim_program_pos = 0;
+}
+
+static void
+SimDriverRestart(void)
+{
+    // The timer starts the program of the line selected by CSEL, and runs
+    //  line programs again once a handler loads one of their intervals
+    //  (see SimDriverInterval), rather than idling
+    SimStartLine(g_sim_driver_running);
+    g_sim_driver_running = false;
+    g_sim_driver_restarted = true;
+}
+
+static void
+SimDriverInterval(bool sent)
+{
+    // Follow the interval loaded by the driver timer handler through the
+    //  programs of the profiles; the line ends with the last interval of
+    //  the program it ran
+    uintptr_t profile, interval = g_sim_ct32b0.MR0;
+    bool ended = false;
+
+    if (g_sim_driver_restarted || !sent) {
+        return;
+    }
+    g_sim_driver_running = true;
+    if (!g_sim_program_pos) {
+        g_sim_program_depths = 0;
+        for (profile = 0; profile < PROFILES; ++profile) {
+            g_sim_program_depths |= 1 << PROFILE_BITS[profile];
+        }
+    }
+    for (profile = 0; profile < PROFILES; ++profile) {
+        uintptr_t bits = PROFILE_BITS[profile];
+        uintptr_t length = PROGRAM_LENGTH(bits);
+        if (!(g_sim_program_depths & (1 << bits))) {
+            continue;
+        }
+        if (PROGRAM_INTERVAL[bits][length - 1 - g_sim_program_pos] !=
+                interval) {
+            g_sim_program_depths &= ~(1 << bits);
+        } else if (g_sim_program_pos + 1 == length) {
+            ended = true;
+        }
+    }
+    g_sim_program_pos++;
+    if (ended) {
+        SimStartLine(true);
+    } else if (!g_sim_program_depths) {
+        SimTrace("TIMER", "%lu in no program", (unsigned long)interval);
+        g_sim_program_pos = 0;
+    }
+}
+
+static void
+SimReportIRef(void)
+{
+    uintptr_t level, dir = 0, out = 0;
+#define GET_IREF(n) \
+    do { \
+        dir |= (!!(g_sim_gpio.DIR[VREF ## n ## _PORT] & \
+                (1 << VREF ## n ## _PIN))) << n; \
+        out |= (!!(g_sim_pins[VREF ## n ## _PORT] & \
+                (1 << VREF ## n ## _PIN))) << n; \
+    } while (false)
+    GET_IREF(0);
+    GET_IREF(1);
+    GET_IREF(2);
+    GET_IREF(3);
+    GET_IREF(4);
+    GET_IREF(5);
+    GET_IREF(6);
+#undef GET_IREF
+    for (level = 0; level < IREF_LEVELS; ++level) {
+        uintptr_t mask = (1 << VREF_SIZE) - 1;
+        if ((IREF_DIR[level] & mask) == dir &&
+                ((IREF_OUT[level] & dir) & mask) == (out & dir)) {
+            break;
+        }
+    }
+    if ((intptr_t)level != g_sim_iref) {
+        g_sim_iref = (intptr_t)level;
+        if (level < IREF_LEVELS) {
+            SimTrace("IREF", "%lu", (unsigned long)level);
+        } else {
+            SimTrace("IREF", "? dir=%02lx out=%02lx",
+                    (unsigned long)dir, (unsigned long)out);
+        }
+    }
+}
+
+/*
+ * SSP0 (driver link)
+ */
+
+static void
+SimTransmit(uint32_t data)
+{
+    uint64_t bits = (g_sim_ssp0.CR0 & 0xf) + 1;
+    uint64_t scr = ((g_sim_ssp0.CR0 >> 8) & 0xff) + 1;
+    uint64_t cycles = bits * scr * g_sim_ssp0.CPSR * g_sim_syscon.SSP0CLKDIV;
+
+    if (!(g_sim_syscon.SYSAHBCLKCTRL & SYSAHBCLKCTRL_SSP0) ||
+            !(g_sim_syscon.PRESETCTRL & PRESETCTRL_SSP0_RST_N) ||
+            !(g_sim_ssp0.CR1 & SSP_SSE_ENABLED) || !cycles) {
+        SimTrace("SSP0", "%04lx disabled", (unsigned long)data);
+        g_sim_tx_dropped++;
+        return;
+    }
+    if (g_sim_tx_count == SIM_SSP_FIFO) {
+        SimTrace("SSP0", "%04lx overflow", (unsigned long)data);
+        g_sim_tx_dropped++;
+        return;
+    }
+    SimTrace("SSP0", "%04lx", (unsigned long)data);
+    g_sim_tx_words++;
+    if (g_sim_tx_end < g_sim_time) {
+        g_sim_tx_end = g_sim_time;
+    }
+    g_sim_tx_end += cycles;
+    g_sim_tx[(g_sim_tx_head + g_sim_tx_count++) % SIM_SSP_FIFO] =
+            (SimTxWord){ g_sim_tx_end, data & ((1 << bits) - 1) };
+}
+
+static void
+SimLatch(void)
+{
+    intptr_t i;
+
+    SimIntegrate();
+    for (i = LINE_WORDS - 1; i > 0; --i) {
+        g_sim_chain[i] = g_sim_chain[i - 1];
+    }
+    g_sim_chain[0] = g_sim_tx[g_sim_tx_head].data;
+    g_sim_tx_head = (g_sim_tx_head + 1) % SIM_SSP_FIFO;
+    g_sim_tx_count--;
+    // With CPHA set, SSEL0 (LED_LATCH) stays low while the next word
+    //  follows at once
+    if ((g_sim_ssp0.CR0 & SSP_CPHA_BACK_TO) && g_sim_tx_count) {
+        return;
+    }
+    memcpy(g_sim_line, g_sim_chain, sizeof(g_sim_line));
+}
+
+/*
+ * SSP1 (host link)
+ */
+
+static uint64_t
+SimHostWordCycles(void)
+{
+    return 16 * (uint64_t)SystemCoreClock / g_sim_host_clk;
+}
+
+static void
+SimArrive(void)
+{
+    HOST_DATA data = g_sim_host[g_sim_host_next++].data;
+    g_sim_host_words++;
+    if (g_sim_miso_count) {
+        // Only driven on MISO while slave output is enabled
+        if (!(g_sim_ssp1.CR1 & SSP_SOD_OUTPUT_DISABLED)) {
+            SimTrace("MISO", "%04x", g_sim_miso[g_sim_miso_head]);
+        }
+        g_sim_miso_head = (g_sim_miso_head + 1) % SIM_SSP_FIFO;
+        g_sim_miso_count--;
+    }
+    g_sim_rx_time = g_sim_time;
+    g_sim_rx_timeout = false;
+    if (g_sim_rx_count == SIM_SSP_FIFO) {
+        SimTrace("HOST", "%04x overrun", data);
+        g_sim_rx_overruns++;
+        g_sim_rx_overrun = true;
+        return;
+    }
+    SimTrace("HOST", "%04x", data);
+    g_sim_rx[(g_sim_rx_head + g_sim_rx_count++) % SIM_SSP_FIFO] = data;
+}
+
+static void
+SimReceive(void)
+{
+    // Expose the word at the head of the receive FIFO in DR; it stays in
+    //  the FIFO, and counts for RNE, RXIM and RTIM, until the handler has
+    //  read it (see SimAccessSSP1)
+    g_sim_rx_accesses = 0;
+    if (g_sim_rx_count) {
+        g_sim_ssp1.DR = g_sim_rx[g_sim_rx_head] | SIM_DR_EXPOSED;
+    }
+}
+
+void
+SimAccessSSP1(void)
+{
+    // The handler reads SR and then DR for each word it takes from the
+    //  receive FIFO, so the word exposed in DR is read by the second access
+    //  after it was exposed and taken out at the third, which is the SR
+    //  read for the next word
+    if (g_sim_exception == SIM_EXCEPTION(SSP1_IRQn) && g_sim_rx_count &&
+            ++g_sim_rx_accesses == 3) {
+        g_sim_rx_head = (g_sim_rx_head + 1) % SIM_SSP_FIFO;
+        g_sim_rx_count--;
+        SimReceive();
+        g_sim_rx_accesses = 1;
+    }
+    SimCommit();
+}
+
+static uint32_t
+SimSSP1RawStatus(void)
+{
+    return (g_sim_rx_overrun ? SSP_IMSC_RORIM : 0) |
+            (g_sim_rx_count && g_sim_rx_timeout ? SSP_IMSC_RTIM : 0) |
+            (g_sim_rx_count >= SIM_SSP_FIFO / 2 ? SSP_IMSC_RXIM : 0);
+}
+
+/*
+ * CT32B0 (driver timer), CT32B1 (render timer) and CT16B0 (dim timer)
+ */
+
+static uint32_t
+SimTimerCount(const SimTimer *t)
+{
+    if (!(t->tcr & CT32B0_CEN_ENABLED) || (t->tcr & CT32B0_CRST_RESET)) {
+        return t->tc;
+    }
+    return t->tc + (uint32_t)((g_sim_time - t->tc_time) /
+            ((uint64_t)t->pr + 1));
+}
+
+static void
+SimTimerSet(SimTimer *t, uint32_t tc)
+{
+    t->tc = tc;
+    t->tc_time = g_sim_time;
+}
+
+static void
+SimTimerSchedule(SimTimer *t)
+{
+    uint32_t mcr = t->regs->MCR;
+    uint32_t tc = SimTimerCount(t);
+    uint64_t ticks, reset;
+
+    t->match = SIM_NEVER;
+    if (!(t->tcr & CT32B0_CEN_ENABLED) || (t->tcr & CT32B0_CRST_RESET) ||
+            !(mcr & (CT32B0_MCR_MR0I | CT32B0_MCR_MR0R | CT32B0_MCR_MR0S))) {
+        return;
+    }
+    ticks = (uint32_t)(t->regs->MR0 - tc);
+    if (!ticks) {
+        ticks = (uint64_t)1 << 32;
+    }
+    // MR1 resets the counter on the tick after it matches
+    reset = (uint32_t)(t->regs->MR1 - tc);
+    if ((mcr & CT32B0_MCR_MR1R) && reset && reset < ticks) {
+        ticks = reset + 1 + t->regs->MR0;
+    }
+    t->match = t->tc_time + ((uint64_t)(uint32_t)(tc - t->tc) +
+            ticks) * ((uint64_t)t->pr + 1);
+}
+
+static void
+SimTimerMatch(SimTimer *t)
+{
+    uint32_t mcr = t->regs->MCR;
+    if (mcr & CT32B0_MCR_MR0I) {
+        t->ir |= CT32B0_IR_MR0INT;
+    }
+    // With MR0R, TC becomes 0 on the tick after the match
+    SimTimerSet(t, (mcr & CT32B0_MCR_MR0R) ? (uint32_t)-1 : t->regs->MR0);
+    if (mcr & CT32B0_MCR_MR0S) {
+        t->tcr &= ~CT32B0_CEN_ENABLED;
+    }
+    SimTimerSchedule(t);
+}
+
+/*
+ * SysTick
+ */
+
+static uint32_t
+SimSysTickCount(void)
+{
+    uint64_t elapsed = g_sim_time - g_sim_systick_time;
+    uint64_t period = (uint64_t)(g_sim_systick.LOAD &
+            SysTick_LOAD_RELOAD_Msk) + 1;
+
+    if (!(g_sim_systick.CTRL & SysTick_CTRL_ENABLE_Msk)) {
+        return g_sim_systick_val;
+    }
+    if (elapsed <= g_sim_systick_val) {
+        return g_sim_systick_val - (uint32_t)elapsed;
+    }
+    // VAL reloads from LOAD on the tick after it reaches 0
+    return (uint32_t)(period - 1 -
+            (elapsed - g_sim_systick_val - 1) % period);
+}
+
+/*
+ * Register side effects
+ */
+
+static void
+SimCommitGPIO(void)
+{
+    uintptr_t port, i;
+    for (port = 0; port < 2; ++port) {
+        uint32_t pins = g_sim_pins[port];
+        uint32_t *w = &g_sim_gpio_w[port * 32];
+        uint8_t *b = &g_sim_gpio_b[port * 32];
+
+        if (memcmp((const void *)&g_sim_gpio.W[port * 32], w,
+                32 * sizeof(*w))) {
+            for (i = 0; i < 32; ++i) {
+                if (g_sim_gpio.W[port * 32 + i] != w[i]) {
+                    pins = (pins & ~(1 << i)) |
+                            ((!!g_sim_gpio.W[port * 32 + i]) << i);
+                }
+            }
+        }
+        if (memcmp((const void *)&g_sim_gpio.B[port * 32], b,
+                32 * sizeof(*b))) {
+            for (i = 0; i < 32; ++i) {
+                if (g_sim_gpio.B[port * 32 + i] != b[i]) {
+                    pins = (pins & ~(1 << i)) |
+                            ((!!g_sim_gpio.B[port * 32 + i]) << i);
+                }
+            }
+        }
+        if (g_sim_gpio.PIN[port] != g_sim_pins[port]) {
+            pins = g_sim_gpio.PIN[port];
+        }
+        if (g_sim_gpio.SET[port] != g_sim_pins[port]) {
+            pins |= g_sim_gpio.SET[port];
+        }
+        pins &= ~g_sim_gpio.CLR[port];
+        pins ^= g_sim_gpio.NOT[port];
+        SimSetPins(port, pins);
+
+        pins = g_sim_pins[port];
+        for (i = 0; i < 32; ++i) {
+            g_sim_gpio.W[port * 32 + i] = w[i] = (pins & (1 << i)) ?
+                    UINT32_MAX : 0;
+            g_sim_gpio.B[port * 32 + i] = b[i] = !!(pins & (1 << i));
+        }
+        g_sim_gpio.PIN[port] = g_sim_gpio.SET[port] = pins;
+        g_sim_gpio.CLR[port] = g_sim_gpio.NOT[port] = 0;
+    }
+}
+
+static void
+SimCommitSSP(void)
+{
+    // Words stop shifting while the SSP0 clock is gated, and go on from
+    //  where they were once it runs again
+    bool clocked = g_sim_syscon.SYSAHBCLKCTRL & SYSAHBCLKCTRL_SSP0;
+    if (!clocked && g_sim_tx_gated == SIM_NEVER) {
+        g_sim_tx_gated = g_sim_time;
+        if (g_sim_tx_count) {
+            SimTrace("SSP0", "gated with %lu words queued",
+                    (unsigned long)g_sim_tx_count);
+        }
+    } else if (clocked && g_sim_tx_gated != SIM_NEVER) {
+        uint64_t delay = g_sim_time - g_sim_tx_gated;
+        size_t i;
+        for (i = 0; i < g_sim_tx_count; ++i) {
+            g_sim_tx[(g_sim_tx_head + i) % SIM_SSP_FIFO].time += delay;
+        }
+        if (g_sim_tx_end > g_sim_tx_gated) {
+            g_sim_tx_end += delay;
+        }
+        g_sim_tx_gated = SIM_NEVER;
+    }
+    if (g_sim_ssp0.DR != SIM_DR_IDLE) {
+        SimTransmit(g_sim_ssp0.DR);
+        g_sim_ssp0.DR = SIM_DR_IDLE;
+    }
+    g_sim_ssp0.SR = (g_sim_tx_count ? SSP_SR_BSY : SSP_SR_TFE) |
+            (g_sim_tx_count < SIM_SSP_FIFO ? SSP_SR_TNF : 0);
+
+    if (!(g_sim_ssp1.DR & SIM_DR_EXPOSED)) {
+        if (g_sim_miso_count == SIM_SSP_FIFO) {
+            SimTrace("MISO", "%04lx overflow",
+                    (unsigned long)(g_sim_ssp1.DR & HOST_DATA_MASK));
+        } else {
+            g_sim_miso[(g_sim_miso_head + g_sim_miso_count++) %
+                    SIM_SSP_FIFO] = (HOST_DATA)g_sim_ssp1.DR;
+        }
+        g_sim_ssp1.DR |= SIM_DR_EXPOSED;
+    }
+    if (g_sim_ssp1.ICR & SSP_IMSC_RORIM) {
+        g_sim_rx_overrun = false;
+    }
+    if (g_sim_ssp1.ICR & SSP_IMSC_RTIM) {
+        g_sim_rx_timeout = false;
+    }
+    g_sim_ssp1.ICR = 0;
+    g_sim_ssp1.RIS = SimSSP1RawStatus();
+    g_sim_ssp1.MIS = g_sim_ssp1.RIS & g_sim_ssp1.IMSC;
+    g_sim_ssp1.SR = (g_sim_miso_count ? 0 : SSP_SR_TFE) |
+            (g_sim_miso_count < SIM_SSP_FIFO ? SSP_SR_TNF : 0) |
+            (g_sim_rx_count ? SSP_SR_RNE : 0) |
+            (g_sim_rx_count == SIM_SSP_FIFO ? SSP_SR_RFF : 0);
+}
+
+static void
+SimCommitTimer(SimTimer *t)
+{
+    LPC_CTxxBx_Type *regs = t->regs;
+    uint32_t tc = SimTimerCount(t);
+
+    if (regs->PR != t->pr) {
+        SimTimerSet(t, tc);
+        t->pr = regs->PR;
+    }
+    if (regs->TC != t->tc_exposed) {
+        SimTimerSet(t, tc = regs->TC);
+    }
+    if (regs->TCR != t->tcr) {
+        SimTimerSet(t, (regs->TCR & CT32B0_CRST_RESET) ? 0 : tc);
+        t->tcr = regs->TCR;
+        if (t == &g_sim_timers[SIM_TIMER_CT32B0] &&
+                (regs->TCR & CT32B0_CRST_RESET)) {
+            SimDriverRestart();
+        }
+    }
+    if (!(regs->IR & SIM_IR_EXPOSED)) {
+        t->ir &= ~regs->IR;
+    }
+    SimTimerSchedule(t);
+
+    regs->TC = t->tc_exposed = SimTimerCount(t);
+    regs->TCR = t->tcr;
+    regs->IR = t->ir | SIM_IR_EXPOSED;
+    regs->PC = 0;
+}
+
+static void
+SimCommitSysTick(void)
+{
+    // Any write to VAL clears it
+    uint32_t val = SimSysTickCount();
+    if (g_sim_systick.VAL != g_sim_systick_exposed) {
+        val = 0;
+    }
+    g_sim_systick_val = val;
+    g_sim_systick_time = g_sim_time;
+    g_sim_systick.VAL = g_sim_systick_exposed = val;
+}
+
+static void
+SimCommitSCB(void)
+{
+    if (g_sim_scb.ICSR & SCB_ICSR_PENDSVCLR_Msk) {
+        g_sim_pendsv = false;
+    } else if (g_sim_scb.ICSR & SCB_ICSR_PENDSVSET_Msk) {
+        g_sim_pendsv = true;
+    }
+    g_sim_scb.ICSR = 0;
+}
+
+void
+SimCommit(void)
+{
+    uintptr_t i;
+    SimCommitGPIO();
+    SimCommitSSP();
+    for (i = 0; i < SIM_TIMERS; ++i) {
+        SimCommitTimer(&g_sim_timers[i]);
+    }
+    SimCommitSysTick();
+    SimCommitSCB();
+}
+
+/*
+ * Exceptions
+ */
+
+static bool
+SimIsPending(uintptr_t exception)
+{
+    uintptr_t irq;
+    if (exception == SIM_EXCEPTION(PendSV_IRQn)) {
+        return g_sim_pendsv;
+    }
+    if (exception < SIM_EXCEPTION(0)) {
+        return false;
+    }
+    irq = exception - SIM_EXCEPTION(0);
+    if (!(g_sim_irq_enabled & (1 << irq))) {
+        return false;
+    }
+    if (g_sim_irq_pending & (1 << irq)) {
+        return true;
+    }
+    switch (irq) {
+    case TIMER_32_0_IRQn:
+        return !!(g_sim_timers[SIM_TIMER_CT32B0].ir & (CT32B0_IR_MR0INT |
+                CT32B0_IR_MR1INT | CT32B0_IR_MR2INT | CT32B0_IR_MR3INT));
+    case TIMER_32_1_IRQn:
+        return !!(g_sim_timers[SIM_TIMER_CT32B1].ir & (CT32B0_IR_MR0INT |
+                CT32B0_IR_MR1INT | CT32B0_IR_MR2INT | CT32B0_IR_MR3INT));
+    case TIMER_16_0_IRQn:
+        return !!(g_sim_timers[SIM_TIMER_CT16B0].ir & (CT32B0_IR_MR0INT |
+                CT32B0_IR_MR1INT | CT32B0_IR_MR2INT | CT32B0_IR_MR3INT));
+    case SSP1_IRQn:
+        return !!(SimSSP1RawStatus() & g_sim_ssp1.IMSC);
+    default:
+        return false;
+    }
+}
+
+static intptr_t
+SimNextException(bool masked)
+{
+    uintptr_t exception;
+    intptr_t next = -1;
+    uintptr_t prio = g_sim_exec_prio;
+    if (masked && g_sim_primask) {
+        return -1;
+    }
+    for (exception = 0; exception < SIM_EXCEPTIONS; ++exception) {
+        if (g_sim_prio[exception] < prio && SimIsPending(exception)) {
+            next = (intptr_t)exception;
+            prio = g_sim_prio[exception];
+        }
+    }
+    return next;
+}
+
+static void
+SimRunHandler(uintptr_t exception)
+{
+    uintptr_t exec_prio = g_sim_exec_prio;
+    uintptr_t running = g_sim_exception;
+    unsigned long driver_words = g_sim_tx_words + g_sim_tx_dropped;
+    uint64_t nested_ns = g_sim_nested_ns;
+    uint64_t start_ns, elapsed_ns;
+    SimHandlerStats *stats = &g_sim_stats[exception];
+
+    g_sim_exec_prio = g_sim_prio[exception];
+    if (exception == SIM_EXCEPTION(PendSV_IRQn)) {
+        g_sim_pendsv = false;
+    } else if (exception >= SIM_EXCEPTION(0)) {
+        g_sim_irq_pending &= ~(1 << (exception - SIM_EXCEPTION(0)));
+    }
+    if (exception == SIM_EXCEPTION(SSP1_IRQn)) {
+        SimReceive();
+    } else if (exception == SIM_EXCEPTION(TIMER_32_0_IRQn)) {
+        if (g_sim_timer_irq_time) {
+            SimTrace("TIMER", "%llu", (unsigned long long)((g_sim_time -
+                    g_sim_timer_irq_time) /
+                    ((uint64_t)g_sim_timers[SIM_TIMER_CT32B0].pr + 1)));
+        }
+        g_sim_timer_irq_time = g_sim_time;
+    }
+    SimCommit();
+
+    g_sim_nested_ns = 0;
+    start_ns = SimHostNanoseconds();
+    g_sim_exception = exception;
+    g_sim_driver_restarted = false;
+    g_sim_vectors[exception]();
+    SimCommit();
+    elapsed_ns = SimHostNanoseconds() - start_ns;
+    if (exception == SIM_EXCEPTION(TIMER_32_0_IRQn)) {
+        SimDriverInterval(driver_words != g_sim_tx_words + g_sim_tx_dropped);
+    }
+    g_sim_exception = running;
+
+    stats->count++;
+    stats->total_ns += elapsed_ns - g_sim_nested_ns;
+    if (stats->max_ns < elapsed_ns - g_sim_nested_ns) {
+        stats->max_ns = elapsed_ns - g_sim_nested_ns;
+    }
+    g_sim_nested_ns = nested_ns + elapsed_ns;
+    g_sim_exec_prio = exec_prio;
+    SimReportIRef();
+}
+
+static bool
+SimDispatch(void)
+{
+    intptr_t exception;
+    bool ran = false;
+    while ((exception = SimNextException(true)) >= 0) {
+        SimRunHandler((uintptr_t)exception);
+        ran = true;
+    }
+    return ran;
+}
+
+/*
+ * Scheduler
+ */
+
+static void
+SimFinish(void)
+{
+    uintptr_t exception;
+    SimIntegrate();
+    fprintf(stderr, "tbhb-sim: %.1f us, %lu scans, %lu host words "
+            "(%lu overruns), %lu driver words (%lu dropped)\n",
+            (double)g_sim_time * 1000000 / SystemCoreClock, g_sim_scans,
+            g_sim_host_words, g_sim_rx_overruns,
+            g_sim_tx_words, g_sim_tx_dropped);
+    for (exception = 0; exception < SIM_EXCEPTIONS; ++exception) {
+        const SimHandlerStats *stats = &g_sim_stats[exception];
+        if (!stats->count) {
+            continue;
+        }
+        fprintf(stderr, "tbhb-sim: %-10s %10lu calls, "
+                "%8.1f ns avg, %8llu ns max (host time)\n",
+                g_sim_names[exception], stats->count,
+                (double)stats->total_ns / stats->count,
+                (unsigned long long)stats->max_ns);
+    }
+    fflush(stdout);
+    exit(g_sim_time >= g_sim_time_limit ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static uint64_t
+SimNextEvent(void)
+{
+    uint64_t next = SIM_NEVER;
+    uintptr_t i;
+    for (i = 0; i < SIM_TIMERS; ++i) {
+        if (g_sim_timers[i].match < next) {
+            next = g_sim_timers[i].match;
+        }
+    }
+    if (g_sim_host_next < g_sim_host_count &&
+            g_sim_host[g_sim_host_next].time < next) {
+        next = g_sim_host[g_sim_host_next].time;
+    }
+    if (g_sim_tx_count && g_sim_tx_gated == SIM_NEVER &&
+            g_sim_tx[g_sim_tx_head].time < next) {
+        next = g_sim_tx[g_sim_tx_head].time;
+    }
+    if (g_sim_rx_count && !g_sim_rx_timeout) {
+        uint64_t timeout = g_sim_rx_time +
+                SIM_SSP_TIMEOUT * SimHostWordCycles() / 16;
+        if (timeout < next) {
+            next = timeout;
+        }
+    }
+    return next;
+}
+
+static void
+SimStep(void)
+{
+    uint64_t next = SimNextEvent();
+    uintptr_t i;
+
+    if (g_sim_host_next == g_sim_host_count && !g_sim_rx_count &&
+            g_sim_done_scans == ULONG_MAX) {
+        g_sim_done_scans = g_sim_scans + g_sim_tail_scans;
+    }
+    if (g_sim_scans >= g_sim_done_scans) {
+        SimFinish();
+    }
+    if (next == SIM_NEVER) {
+        // Nothing left to happen, as with the panel idle
+        SimFinish();
+    }
+    if (next >= g_sim_time_limit) {
+        if (next != SIM_NEVER) {
+            g_sim_time = g_sim_time_limit;
+        }
+        fprintf(stderr, "tbhb-sim: stopped at time limit\n");
+        SimFinish();
+    }
+
+    g_sim_time = next;
+    while (g_sim_tx_count && g_sim_tx_gated == SIM_NEVER &&
+            g_sim_tx[g_sim_tx_head].time == next) {
+        SimLatch();
+    }
+    for (i = 0; i < SIM_TIMERS; ++i) {
+        if (g_sim_timers[i].match == next) {
+            SimTimerMatch(&g_sim_timers[i]);
+        }
+    }
+    while (g_sim_host_next < g_sim_host_count &&
+            g_sim_host[g_sim_host_next].time == next) {
+        SimArrive();
+    }
+    if (g_sim_rx_count && !g_sim_rx_timeout && next >= g_sim_rx_time +
+            SIM_SSP_TIMEOUT * SimHostWordCycles() / 16) {
+        g_sim_rx_timeout = true;
+    }
+    SimCommit();
+}
+
+void
+__WFI(void)
+{
+    uint64_t nested_ns = g_sim_nested_ns;
+    uint64_t start_ns = SimHostNanoseconds();
+
+    SimCommit();
+    SimReportIRef();
+    for (;;) {
+        if (SimDispatch() || (g_sim_primask && SimNextException(false) >= 0)) {
+            break;
+        }
+        SimStep();
+    }
+    // Time spent waiting is not charged to an interrupted handler
+    g_sim_nested_ns = nested_ns + SimHostNanoseconds() - start_ns;
+}
+
+void
+__enable_irq(void)
+{
+    g_sim_primask = false;
+    SimCommit();
+    SimDispatch();
+}
+
+void
+__disable_irq(void)
+{
+    g_sim_primask = true;
+}
+
+void
+NVIC_EnableIRQ(IRQn_Type irq)
+{
+    g_sim_irq_enabled |= (1 << irq);
+}
+
+void
+NVIC_DisableIRQ(IRQn_Type irq)
+{
+    g_sim_irq_enabled &= ~(1 << irq);
+}
+
+uint32_t
+NVIC_GetPendingIRQ(IRQn_Type irq)
+{
+    return !!(g_sim_irq_pending & (1 << irq));
+}
+
+void
+NVIC_SetPendingIRQ(IRQn_Type irq)
+{
+    g_sim_irq_pending |= (1 << irq);
+}
+
+void
+NVIC_ClearPendingIRQ(IRQn_Type irq)
+{
+    g_sim_irq_pending &= ~(1 << irq);
+}
+
+void
+NVIC_SetPriority(IRQn_Type irq, uint32_t priority)
+{
+    g_sim_prio[SIM_EXCEPTION(irq)] =
+            (uint8_t)(priority & (SIM_PRIO_THREAD - 1));
+}
+
+uint32_t
+NVIC_GetPriority(IRQn_Type irq)
+{
+    return g_sim_prio[SIM_EXCEPTION(irq)];
+}
+
+void
+SystemInit(void)
+{
+}
+
+void
+SystemCoreClockUpdate(void)
+{
+}
+
+/*
+ * Input
+ */
+
+static void
+SimAddHostWord(uint64_t *time, HOST_DATA data)
+{
+    static size_t capacity;
+    if (g_sim_host_count == capacity) {
+        capacity = capacity ? capacity * 2 : 1024;
+        g_sim_host = realloc(g_sim_host, capacity * sizeof(*g_sim_host));
+        if (!g_sim_host) {
+            perror("tbhb-sim");
+            exit(EXIT_FAILURE);
+        }
+    }
+    *time += SimHostWordCycles();
+    g_sim_host[g_sim_host_count++] = (SimHostWord){ *time, data };
+}
+
+static void
+SimLoadBinary(FILE *file)
+{
+    uint8_t word[2];
+    uint64_t time = 0;
+    while (fread(word, sizeof(word), 1, file) == 1) {
+        SimAddHostWord(&time, (HOST_DATA)(word[0] | (word[1] << 8)));
+    }
+}
+
+static void
+SimLoadText(FILE *file)
+{
+    char token[64];
+    uint64_t time = 0;
+    int c;
+
+    while (fscanf(file, " %63s", token) == 1) {
+        char *end;
+        if (token[0] == '#') {
+            while ((c = fgetc(file)) != EOF && c != '\n') {
+            }
+        } else if (!strcmp(token, "wait")) {
+            double us;
+            if (fscanf(file, " %lf", &us) != 1 || us < 0) {
+                fprintf(stderr, "tbhb-sim: expected microseconds "
+                        "after 'wait'\n");
+                exit(EXIT_FAILURE);
+            }
+            time += SimCyclesFromMicroseconds(us);
+        } else {
+            unsigned long data = strtoul(token, &end, 16);
+            if (*end || data > HOST_DATA_MASK) {
+                fprintf(stderr, "tbhb-sim: invalid word '%s'\n", token);
+                exit(EXIT_FAILURE);
+            }
+            SimAddHostWord(&time, (HOST_DATA)data);
+        }
+    }
+}
+
+// Check the compile-time tables of program.h against the loops that built
+// them at boot before they were moved to flash
+static void
+SimCheckPrograms(void)
+{
+    intptr_t bits, i, j, pos;
+    bool ok = true;
+
+    for (bits = 2; bits <= BITS; ++bits) {
+        const intptr_t length = PROGRAM_LENGTH(bits);
+        uintptr_t interval[PROGRAM_SIZE], mask[PROGRAM_SIZE - 1];
+        uintptr_t bit[PROGRAM_SIZE - 1], first[PLANE_PAIRS] = { 0 };
+        intptr_t index = 0;
+
+        for (i = 1; i < bits; ++i) {
+            for (j = i - 1; j >= 0; --j) {
+                interval[length - index - 2] =
+                        ((j == 0) ? 1 : (1 << (j - 1))) * 2 - 1;
+                mask[index] = 0;
+                for (pos = DRIVER_CHANNELS - j - 1; pos >= 0; pos -= bits) {
+                    mask[index] |= (1 << pos);
+                }
+                bit[index++] = i;
+            }
+        }
+        for (i = bits - 1; i > 0; --i) {
+            for (j = 0; j < i; ++j) {
+                interval[length - index - 2] =
+                        ((j + 1 == i) ? 1 : (1 << j)) * 2 - 1;
+                mask[index] = 0;
+                for (pos = DRIVER_CHANNELS - i - 1; pos >= 0; pos -= bits) {
+                    mask[index] |= (1 << pos);
+                }
+                bit[index++] = j;
+            }
+        }
+        interval[length - 1] = 1;
+        for (pos = DRIVER_CHANNELS - 1, j = 0; pos >= 0; --pos) {
+            first[j / 2] |= ((plane_pair_t)1 << pos) << ((j & 1) * 16);
+            j = (j == (bits - 1)) ? 0 : (j + 1);
+        }
+
+        for (i = 0; i < length; ++i) {
+            ok &= PROGRAM_INTERVAL[bits][i] == interval[i];
+        }
+        for (i = 0; i < length - 1; ++i) {
+            ok &= PROGRAM_SCHEDULE[bits][i] ==
+                    (mask[i] | ((bit[i] * LINE_WORDS) << 16));
+        }
+        for (i = 0; i < PLANE_PAIRS; ++i) {
+            ok &= PROGRAM_FIRST[bits][i] == first[i];
+        }
+        if (!ok) {
+            fprintf(stderr, "tbhb-sim: program tables differ for %ld bits\n",
+                    (long)bits);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Scans are traced by following the timer through the programs of the
+    //  profiles (see SimDriverInterval), so none of them may start with
+    //  the whole of another
+    for (i = 0; i < (intptr_t)PROFILES; ++i) {
+        for (j = 0; j < (intptr_t)PROFILES; ++j) {
+            const uintptr_t a = PROFILE_BITS[i], b = PROFILE_BITS[j];
+            const intptr_t length = PROGRAM_LENGTH(a);
+            if (a == b || length > (intptr_t)PROGRAM_LENGTH(b)) {
+                continue;
+            }
+            for (pos = 1; pos <= length; ++pos) {
+                if (PROGRAM_INTERVAL[a][length - pos] !=
+                        PROGRAM_INTERVAL[b][PROGRAM_LENGTH(b) - pos]) {
+                    break;
+                }
+            }
+            if (pos > length) {
+                fprintf(stderr, "tbhb-sim: program for %lu bits starts "
+                        "the one for %lu bits\n", (unsigned long)a,
+                        (unsigned long)b);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    // Hosts encode HOST_PLANES from the same 8-bit levels
+    for (i = 0; i <= 0xffff; ++i) {
+#if CHANNELS == 2
+        ok &= PixelLevel((pixel_t)i, 0) == (uintptr_t)(i & 0xff) &&
+                PixelLevel((pixel_t)i, 1) == (uintptr_t)(i >> 8);
+#else
+        intptr_t r = i & 0x1f, g = (i >> 5) & 0x3f, b = i >> 11;
+        ok &= PixelLevel((pixel_t)i, 0) == (uintptr_t)((r << 3) | (r >> 2)) &&
+                PixelLevel((pixel_t)i, 1) == (uintptr_t)((g << 2) | (g >> 4)) &&
+                PixelLevel((pixel_t)i, 2) == (uintptr_t)((b << 3) | (b >> 2));
+#endif
+    }
+    if (!ok) {
+        fprintf(stderr, "tbhb-sim: PixelLevel differs from host levels\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < LINES; ++i) {
+        intptr_t xor = LINE_SEQUENCE[i] ^ LINE_SEQUENCE[i + 1];
+        intptr_t row = LINE_SEQUENCE[(LINES - i) % LINES];
+        if (PROGRAM_CSEL[i] != (((!!(xor & 1)) << CSEL0_PIN) |
+                ((!!(xor & 2)) << CSEL1_PIN) | ((!!(xor & 4)) << CSEL2_PIN)) ||
+                PROGRAM_CSEL_LINE[i] != (((!!(row & 1)) << CSEL0_PIN) |
+                ((!!(row & 2)) << CSEL1_PIN) | ((!!(row & 4)) << CSEL2_PIN))) {
+            fprintf(stderr, "tbhb-sim: PROGRAM_CSEL differs from "
+                    "LINE_SEQUENCE\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void
+SimReset(void)
+{
+    uintptr_t port, i;
+
+    g_sim_syscon.SYSAHBCLKCTRL = SYSAHBCLKCTRL_SYS | SYSAHBCLKCTRL_ROM |
+            SYSAHBCLKCTRL_RAM0 | SYSAHBCLKCTRL_FLASHREG |
+            SYSAHBCLKCTRL_FLASHARRAY | SYSAHBCLKCTRL_I2C;
+    g_sim_syscon.SYSAHBCLKDIV = 1;
+    g_sim_ssp0.DR = SIM_DR_IDLE;
+    g_sim_ssp1.DR = SIM_DR_EXPOSED;
+    g_sim_ct32b0.IR = SIM_IR_EXPOSED;
+    g_sim_ct32b1.IR = SIM_IR_EXPOSED;
+    for (port = 0; port < 2; ++port) {
+        for (i = 0; i < 32; ++i) {
+            g_sim_gpio.W[port * 32 + i] = g_sim_gpio_w[port * 32 + i] = 0;
+            g_sim_gpio.B[port * 32 + i] = g_sim_gpio_b[port * 32 + i] = 0;
+        }
+    }
+    g_sim_row_line = SimLineOfPins(0);
+    SimCommit();
+}
+
+static void
+SimUsage(const char *name, int status)
+{
+    fprintf(status == EXIT_SUCCESS ? stdout : stderr,
+            "usage: %s [-h] [-b] [-q] [-a] [-c HZ] [-n SCANS] [-t MS] [FILE]\n"
+            "\n"
+            "Run the firmware on host words read from FILE or stdin.\n"
+            "Text input is hex words separated by whitespace, with\n"
+            "'wait US' to idle the host link and '#' comments.\n"
+            "\n"
+            "  -b        read raw little-endian 16-bit words instead\n"
+            "  -q        only print scans, not individual events\n"
+            "  -a        print every scan, not only changed ones\n"
+            "  -c HZ     host SPI clock (default %d)\n"
+            "  -n SCANS  scans to run after the input ends (default 2)\n"
+            "  -t MS     simulated time limit (default 10000)\n"
+            "  -h        print this help\n",
+            name, HOST_SPI_CLK);
+    exit(status);
+}
+
+int
+main(int argc, char **argv)
+{
+    FILE *file = stdin;
+    bool binary = false;
+    double limit_ms = 10000;
+    int opt;
+
+    SimCheckPrograms();
+    while ((opt = getopt(argc, argv, "hbqac:n:t:")) != -1) {
+        switch (opt) {
+        case 'h':
+            SimUsage(argv[0], EXIT_SUCCESS);
+            break;
+        case 'b':
+            binary = true;
+            break;
+        case 'q':
+            g_sim_trace = false;
+            break;
+        case 'a':
+            g_sim_print_all = true;
+            break;
+        case 'c':
+            g_sim_host_clk = strtoull(optarg, NULL, 0);
+            if (!g_sim_host_clk) {
+                SimUsage(argv[0], EXIT_FAILURE);
+            }
+            break;
+        case 'n':
+            g_sim_tail_scans = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            limit_ms = strtod(optarg, NULL);
+            break;
+        default:
+            SimUsage(argv[0], EXIT_FAILURE);
+        }
+    }
+    if (optind + 1 < argc) {
+        SimUsage(argv[0], EXIT_FAILURE);
+    }
+    if (optind < argc && !(file = fopen(argv[optind], binary ? "rb" : "r"))) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if (binary) {
+        SimLoadBinary(file);
+    } else {
+        SimLoadText(file);
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+    g_sim_time_limit = SimCyclesFromMicroseconds(limit_ms * 1000);
+
+    SimReset();
+    FirmwareMain();
+    return EXIT_FAILURE;
+}
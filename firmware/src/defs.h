@@ -10,38 +10,182 @@
 
 #define ALWAYS_INLINE   __attribute__((always_inline))
 
-// Format: 0xGGRR
+// Format: 0xGGRR with 2 channels,
+//  or 0bBBBBBGGGGGGRRRRR (RGB565) with 3 channels
 typedef uint16_t    pixel_t;
 // Format: 0xGGGGRRRR
 typedef uint32_t    gamma_pixel_t;
 
 // Format: 0bXXXXXXXXXXXXXXXX
-//  where each X corresponds to a driver channel
+//  where each X corresponds to a channel of one driver
 typedef uint16_t    line_t;
 
-#define BITS        9
-#define CHANNELS    2   // red and green
+// Panel geometry, which can also be given on the command line. Each line
+//  is driven by a chain of LINE_WORDS drivers of DRIVER_CHANNELS channels,
+//  and each driver holds the channels of DRIVER_PIXELS whole pixels; with
+//  3 channels the last channel of each driver is not used
+#define BITS        9   // Maximum bit depth of any profile
+#ifndef CHANNELS
+#define CHANNELS    2   // red and green, or 3 for red, green and blue
+#endif
+#ifndef WIDTH
 #define WIDTH       8
+#endif
+#ifndef LINES
 #define LINES       8
+#endif
 #define BUFFERS     3
-#define SRC_BUFFERS 2   // Lines of source to buffer
 
+#define DRIVER_CHANNELS 16
+#define DRIVER_PIXELS   (DRIVER_CHANNELS / CHANNELS)
+#define LINE_WORDS      (WIDTH / DRIVER_PIXELS)
+
+#if CHANNELS != 2 && CHANNELS != 3
+#error Change TransposePixel below
+#endif
+#if WIDTH % DRIVER_PIXELS != 0
+#error WIDTH must fill whole drivers
+#endif
+// Words of a line are queued in the SSP0 FIFO at once
+#define SSP_FIFO_SIZE   8
+#if LINE_WORDS > SSP_FIFO_SIZE
+#error Driver chain is longer than the SSP0 FIFO
+#endif
+#if LINES > 8
+#error More lines need more CSEL pins
+#endif
+
+// Bits of each channel of a pixel_t
+#if CHANNELS == 2
+static const uintptr_t PIXEL_CHANNEL_MASK[CHANNELS] = { 0xff, 0xff00 };
+static const uintptr_t PIXEL_CHANNEL_SHIFT[CHANNELS] = { 0, 8 };
+static const uintptr_t PIXEL_CHANNEL_SIZE[CHANNELS] = { 8, 8 };
+#else
+static const uintptr_t PIXEL_CHANNEL_MASK[CHANNELS] = { 0x1f, 0x7e0, 0xf800 };
+static const uintptr_t PIXEL_CHANNEL_SHIFT[CHANNELS] = { 0, 5, 11 };
+static const uintptr_t PIXEL_CHANNEL_SIZE[CHANNELS] = { 5, 6, 5 };
+#endif
+
+// Mix of weight / 0x100 of pixel a and the rest of pixel b, by level
+ALWAYS_INLINE
+static pixel_t
+BlendPixel(pixel_t a, pixel_t b, uintptr_t weight) {
+    intptr_t i;
+    uintptr_t pixel = 0;
+    for (i = 0; i < CHANNELS; ++i) {
+        uintptr_t mask = PIXEL_CHANNEL_MASK[i];
+        pixel |= ((((uintptr_t)a & mask) * weight +
+                ((uintptr_t)b & mask) * (0x100 - weight)) >> 8) & mask;
+    }
+    return (pixel_t)pixel;
+}
+
+// Channel of pixel x, from the first channel of the first driver
+#define PIXEL_CHANNEL(x) \
+    ((x) / DRIVER_PIXELS * DRIVER_CHANNELS + (x) % DRIVER_PIXELS * CHANNELS)
+
+// Level of 8 bits of channel c of a pixel, which indexes its gamma table
+//  (see HOST_TABLE); narrower channels have their top bits repeated below
+ALWAYS_INLINE
+static uintptr_t
+PixelLevel(pixel_t pixel, uintptr_t c) {
+    uintptr_t size = PIXEL_CHANNEL_SIZE[c];
+    uintptr_t value = ((uintptr_t)pixel & PIXEL_CHANNEL_MASK[c]) >>
+            PIXEL_CHANNEL_SHIFT[c];
+    return (value << (8 - size)) | (value >> (2 * size - 8));
+}
+
+// Most bits of precision added by temporal dithering (see HOST_SET_DITHER),
+//  for levels of up to 16 bits
+#define DITHER_BITS 3
+
+// Level of bits from a level of bits + dither, adding the error left from
+//  the last level of the channel so that levels shown by successive scans
+//  average out to the finer level; without dither the error is kept, so
+//  that channels stay spread out once dithering resumes
+ALWAYS_INLINE
+static uintptr_t
+DitherLevel(uintptr_t level, uintptr_t bits, uintptr_t dither,
+        uint8_t *error) {
+    uintptr_t mask = (1 << dither) - 1;
+    uintptr_t sum = level + (*error & mask);
+    if (dither) {
+        *error = (uint8_t)(sum & mask);
+    }
+    sum >>= dither;
+    return sum - (sum >> bits);
+}
+
+// Bit-planes of a line are kept in pairs, with the lower plane in the
+//  lower half of each word
+typedef uint32_t    plane_pair_t;
+
+#define PLANE_PAIRS ((BITS + 1) / 2)
+
+#if CHANNELS == 2
+// Bits of a 4-bit index (red bit 0, red bit 1, green bit 0, green bit 1)
+//  placed in the last pixel of a line, for both planes of a pair
+#define TRANSPOSE_ENTRY(n) \
+    (((plane_pair_t)((n) & 1) << 14) | \
+    ((plane_pair_t)(((n) >> 2) & 1) << 15) | \
+    ((plane_pair_t)(((n) >> 1) & 1) << 30) | \
+    ((plane_pair_t)(((n) >> 3) & 1) << 31))
+
+static const plane_pair_t TRANSPOSE_PAIR[16] = {
+    TRANSPOSE_ENTRY(0), TRANSPOSE_ENTRY(1), TRANSPOSE_ENTRY(2),
+    TRANSPOSE_ENTRY(3), TRANSPOSE_ENTRY(4), TRANSPOSE_ENTRY(5),
+    TRANSPOSE_ENTRY(6), TRANSPOSE_ENTRY(7), TRANSPOSE_ENTRY(8),
+    TRANSPOSE_ENTRY(9), TRANSPOSE_ENTRY(10), TRANSPOSE_ENTRY(11),
+    TRANSPOSE_ENTRY(12), TRANSPOSE_ENTRY(13), TRANSPOSE_ENTRY(14),
+    TRANSPOSE_ENTRY(15) };
+
+#undef TRANSPOSE_ENTRY
+
+// Shift the levels of one pixel into the bit-planes of a driver; after
+//  DRIVER_PIXELS pixels, the first pixel is in the lowest channels of every
+//  plane
+ALWAYS_INLINE
+static void
+TransposePixel(plane_pair_t *planes, const uintptr_t *channels) {
+    intptr_t i;
+    gamma_pixel_t levels = channels[0] | (channels[1] << 16);
+    for (i = 0; i < PLANE_PAIRS; ++i) {
+        uintptr_t pair = levels & 0x30003;
+        planes[i] = ((planes[i] >> CHANNELS) & ~(3 << 14)) |
+                TRANSPOSE_PAIR[(pair | (pair >> 14)) & 0xf];
+        levels >>= 2;
+    }
+}
+#else
 ALWAYS_INLINE
-static gamma_pixel_t
-CorrectGamma(pixel_t pixel) {
-    uintptr_t red = (((uintptr_t)pixel) & 0xff) + 1;
-    uintptr_t green = (((uintptr_t)pixel) & 0xff00) + 0x100;
-    return ((((uintptr_t)(red * red) - 1) >> (16 - BITS)) |
-            (((uintptr_t)(green * green) - 0x10000) >> (16 - BITS))) &
-            (((1 << BITS) - 1) | ((0x10000 << BITS) - 0x10000));
+static void
+TransposePixel(plane_pair_t *planes, const uintptr_t *channels) {
+    intptr_t i;
+    uintptr_t red = channels[0];
+    uintptr_t green = channels[1];
+    uintptr_t blue = channels[2];
+    for (i = 0; i < PLANE_PAIRS; ++i) {
+        // Bits of plane 2 * i in the lower half, and 2 * i + 1 above
+        plane_pair_t pair = (red & 1) | ((red & 2) << 15) |
+                ((green & 1) << 1) | ((green & 2) << 16) |
+                ((blue & 1) << 2) | ((blue & 2) << 17);
+        planes[i] = ((planes[i] >> CHANNELS) & ~(0xf << 12)) | (pair << 12);
+        red >>= 2;
+        green >>= 2;
+        blue >>= 2;
+    }
 }
+#endif
 
 // Size of a timer program for one line
-#define PROGRAM_SIZE    (((BITS - 1) * BITS) + 1)
+#define PROGRAM_LENGTH(bits)    ((((bits) - 1) * (bits)) + 1)
+#define PROGRAM_SIZE            PROGRAM_LENGTH(BITS)
 
-// Size of program to generate per received pixel, excluding first program
-//  program entry and final received pixel in a line (see SetFrameData)
-#define PROGRAM_STEP    (((PROGRAM_SIZE - 1) + (WIDTH - 2)) / (WIDTH - 1))
+// A staged line holds its bit-planes in the order of the halves of each
+//  plane_pair_t, followed by the first entry of its timer program; each
+//  of them is one word per driver, from the first driver
+#define FRAME_FIRST         (PLANE_PAIRS * 2 * LINE_WORDS)
+#define FRAME_LINE_SIZE     (FRAME_FIRST + LINE_WORDS)
 
 #if (BUFFERS & (BUFFERS - 1)) == 0
 #define ROUND_BUFFER_INDEX(i)   ((i) & (BUFFERS - 1))
@@ -49,14 +193,67 @@ CorrectGamma(pixel_t pixel) {
 #define ROUND_BUFFER_INDEX(i)   ((i) >= BUFFERS ? (i) - BUFFERS : (i))
 #endif
 
-static const intptr_t LINE_SEQUENCE[LINES + 1] = {4, 6, 3, 1, 0, 2, 7, 5, 4};
+#if BUFFERS < 3
+#error Flips need a buffer shown, a buffer flipped and a buffer staged
+#endif
+
+// Row of the line at position i of LINE_SEQUENCE; the 8-line panel has its
+//  own order, packed one row per nibble, and other panels show line y of a
+//  frame on row y
+#if LINES == 8
+#define LINE_ROW(i) ((intptr_t)(0x57201364 >> ((i) % LINES * 4)) & 0xf)
+#else
+#define LINE_ROW(i) ((intptr_t)((LINES - (i) % LINES) % LINES))
+#endif
+
+// m(0), m(1), ... m(n - 1), for tables with an entry per line
+#define LINE_EACH_1(m) m(0)
+#define LINE_EACH_2(m) LINE_EACH_1(m), m(1)
+#define LINE_EACH_3(m) LINE_EACH_2(m), m(2)
+#define LINE_EACH_4(m) LINE_EACH_3(m), m(3)
+#define LINE_EACH_5(m) LINE_EACH_4(m), m(4)
+#define LINE_EACH_6(m) LINE_EACH_5(m), m(5)
+#define LINE_EACH_7(m) LINE_EACH_6(m), m(6)
+#define LINE_EACH_8(m) LINE_EACH_7(m), m(7)
+#define MAKE_LINE_EACH_(n, m)   LINE_EACH_ ## n(m)
+#define MAKE_LINE_EACH(n, m)    MAKE_LINE_EACH_(n, m)
+
+static const intptr_t LINE_SEQUENCE[LINES + 1] = {
+    MAKE_LINE_EACH(LINES, LINE_ROW), LINE_ROW(LINES) };
 
 #define HOST_SPI_CLK    4000000
 #define DRIVER_SPI_CLK  12000000
-#define DRIVER_LINE_CLK 600000
+// The shortest timer interval covers the words of a driver chain
+#define DRIVER_LINE_CLK (600000 / LINE_WORDS)
+
+// Bit depth (2 to BITS) of each profile (see HOST_SET_PROFILE); all run
+//  at DRIVER_LINE_CLK, so each bit less halves the scan and doubles the
+//  refresh rate, for as many timer interrupts per scan
+static const uintptr_t PROFILE_BITS[] = { BITS, 8, 7, 6 };
+
+#define PROFILES    (sizeof(PROFILE_BITS) / sizeof(PROFILE_BITS[0]))
 
 #define NVIC_PRIO_DRIVER_TIMER  0
-#define NVIC_PRIO_HOST_SSP      3
+#define NVIC_PRIO_DIM_TIMER     1
+#define NVIC_PRIO_HOST_SSP      2
+#define NVIC_PRIO_HOST_PARSE    3   // PendSV
+#define NVIC_PRIO_RENDER_TIMER  3
+
+// Core cycles from a dim timer match until its handler clears BLANK;
+//  shorter on-times would light the drivers after the interval
+#define DIM_TIMER_LATENCY   32
+
+// Host words received by SSP1 and not yet parsed
+#define HOST_RING_SIZE  128
+
+#if (HOST_RING_SIZE & (HOST_RING_SIZE - 1)) != 0
+#error HOST_RING_SIZE must be a power of 2
+#endif
+
+// Host words only count inside frames checked by a CRC (see
+//  HOST_FRAMED_SYNC in host.h), so that boards recover from a noisy link
+//  at the next good frame; the host library must frame them as well
+//#define HOST_FRAMED
 
 #define MAKE_PIO_(prefix, port, pin)    prefix ## PIO ## port ## _ ## pin
 #define MAKE_PIO(prefix, port, pin)     MAKE_PIO_(prefix, port, pin)
@@ -77,6 +274,14 @@ static const intptr_t LINE_SEQUENCE[LINES + 1] = {4, 6, 3, 1, 0, 2, 7, 5, 4};
 #define CS_PORT     1
 #define CS_PIN      23
 #define CS_PIO      MAKE_PIO(, CS_PORT, CS_PIN)
+// MISO     not connected; MISO1 is PIO0_22 (CSEL0) in this package, so
+//  only boards with PIO1_21 routed (LQFP48) define HOST_MISO
+//#define HOST_MISO
+#ifdef HOST_MISO
+#define MISO_PORT   1
+#define MISO_PIN    21
+#define MISO_PIO    MAKE_PIO(, MISO_PORT, MISO_PIN)
+#endif
 
 // MOSI     pin 18 (PIO0_9/MOSI0/CT16B0_MAT1)
 #define LED_SIN_PORT    0
@@ -20,8 +20,9 @@ typedef uint16_t HOST_DATA;
 #define HOST_COMMAND_LENGTH_SHIFT   14
 #define HOST_ID_MASK                ((1 << HOST_COMMAND_SHIFT) - 1)
 #define HOST_ID_ALL                 0
+#define HOST_ID_BROADCAST           HOST_ID_MASK    // Not a board ID
 #define HOST_COMMAND_MASK           (HOST_DATA_MASK & ~HOST_ID_MASK)
-#define HOST_COMMAND_LENGTH_MASK    (HOST_DATA_MASK & ~HOST_ID_MASK)
+#define HOST_COMMAND_LENGTH_MASK    (3 << HOST_COMMAND_LENGTH_SHIFT)
 
 /* Length of data associated with command
  * HOST_COMMAND_VARIABLE commands have the following structure,
@@ -41,14 +42,322 @@ enum HOST_COMMAND {
     HOST_NOP = (0 << HOST_COMMAND_SHIFT) | HOST_COMMAND_0,
     HOST_ID = (1 << HOST_COMMAND_SHIFT) | HOST_COMMAND_0,
     HOST_FLIP = (2 << HOST_COMMAND_SHIFT) | HOST_COMMAND_0,
+    HOST_STATUS = (3 << HOST_COMMAND_SHIFT) | HOST_COMMAND_0,
 
     HOST_BLANK = (0 << HOST_COMMAND_SHIFT) | HOST_COMMAND_1,
     HOST_IREF = (1 << HOST_COMMAND_SHIFT) | HOST_COMMAND_1,
     HOST_FILL = (2 << HOST_COMMAND_SHIFT) | HOST_COMMAND_1,
+    HOST_TABLE = (3 << HOST_COMMAND_SHIFT) | HOST_COMMAND_1,
+
+    HOST_SET = (0 << HOST_COMMAND_SHIFT) | HOST_COMMAND_2,
+    HOST_WIDGET = (1 << HOST_COMMAND_SHIFT) | HOST_COMMAND_2,
 
     HOST_FRAME = (0 << HOST_COMMAND_SHIFT) | HOST_COMMAND_VARIABLE,
+    HOST_RECT = (1 << HOST_COMMAND_SHIFT) | HOST_COMMAND_VARIABLE,
+    HOST_PACKED = (2 << HOST_COMMAND_SHIFT) | HOST_COMMAND_VARIABLE,
+    HOST_PLANES = (3 << HOST_COMMAND_SHIFT) | HOST_COMMAND_VARIABLE,
+};
+
+/* Boards built with HOST_FRAMED (see defs.h) take host words in frames,
+ *  so that words lost or garbled on the link cost the frames they hit
+ *  rather than the sync of the whole command stream,
+ *  0000: HOST_FRAMED_SYNC
+ *  0002: Number of payload words, up to HOST_FRAMED_WORDS, with
+ *        HOST_FRAMED_CONTINUE if the payload continues a command of an
+ *        earlier frame
+ *  0004: First payload word
+ *  ....
+ *  ....: CRC of the header and payload words, most significant bit first
+ *        (polynomial HOST_CRC_POLY, starting from HOST_CRC_INIT)
+ *  Payloads are parsed as host words once their CRC matches. After a bad
+ *  frame, the board looks for the next HOST_FRAMED_SYNC, drops the command
+ *  it was parsing, and skips frames that continue a command until one
+ *  starts a command. Words between frames, such as the HOST_NOP words that
+ *  read the status, are ignored.
+ */
+#define HOST_FRAMED_SYNC        0xa55a
+#define HOST_FRAMED_WORDS       96
+#define HOST_FRAMED_CONTINUE    0x8000
+#define HOST_CRC_POLY           0x1021
+#define HOST_CRC_INIT           0xffff
+
+/* HOST_STATUS makes the board with the ID of the command, or the board
+ *  without an ID for HOST_ID_ALL, drive its status on MISO. The host leaves
+ *  the link idle for HOST_STATUS_DELAY_US, then clocks in HOST_STATUS_WORDS
+ *  words of HOST_NOP and reads back (see HOST_STATUS_WORD),
+ *  0000: HOST_VERSION
+ *  0002: Frames flipped and waiting to be shown
+ *  0004: Frames shown, including those staged again by HOST_SET_DITHER,
+ *        modulo 0x10000
+ *  0006: Frames dropped by HOST_FLIP, modulo 0x10000
+ *  0008: Receive overruns of the host link, modulo 0x10000
+ *  000a: Most host words received and not yet parsed
+ *  000c: Frames dropped for a bad length or CRC (see HOST_FRAMED_SYNC),
+ *        counting syncs falsely found in payloads, modulo 0x10000
+ *  Boards built without HOST_MISO (see defs.h) never drive MISO. Boards
+ *  parse host words after receiving them, so the delay covers parsing
+ *  the words sent before HOST_STATUS.
+ */
+#define HOST_VERSION            7
+#define HOST_STATUS_DELAY_US    500
+
+enum HOST_STATUS_WORD {
+    HOST_STATUS_VERSION,
+    HOST_STATUS_QUEUED,
+    HOST_STATUS_SHOWN,
+    HOST_STATUS_DROPPED,
+    HOST_STATUS_OVERRUNS,
+    HOST_STATUS_BACKLOG,
+    HOST_STATUS_BAD_FRAMES,
+    HOST_STATUS_WORDS
+};
+
+/* After HOST_SET_STATUS with HOST_STATUS_CYCLES plus a section (see
+ *  HOST_CYCLES_SECTION), HOST_STATUS reports core clock cycles spent in that
+ *  section of the firmware instead, on boards also built with CYCLE_STATS
+ *  (see main.c); other boards report no runs,
+ *  0000: HOST_VERSION
+ *  0002: Section
+ *  0004: Runs of the section, modulo 0x10000
+ *  0006: Fewest cycles of a run, up to 0xffff
+ *  0008: Average cycles of a run, up to 0xffff
+ *  000a: Most cycles of a run, up to 0xffff
+ *  000c: Driver timer interrupts taken a tick or more after their match,
+ *        modulo 0x10000
+ *  Cycles of interrupts taken during a run are included.
+ */
+#define HOST_STATUS_COUNTERS    0
+#define HOST_STATUS_CYCLES      0x100
+
+enum HOST_CYCLES_SECTION {
+    HOST_CYCLES_DRIVER_TIMER,
+    HOST_CYCLES_HOST_SSP,
+    HOST_CYCLES_HOST_PARSE,
+    HOST_CYCLES_SET_FRAME_DATA,
+    HOST_CYCLES_NEXT_FRAME,
+    HOST_CYCLES_RENDER_WIDGETS,
+    HOST_CYCLES_RENDER_FADE,
+    HOST_CYCLES_RENDER_DITHER,
+    HOST_CYCLES_SECTIONS
+};
+
+/* HOST_FRAME sent to HOST_ID_BROADCAST carries the frames of all boards,
+ *  each board taking WIDTH * LINES pixels starting from pixel
+ *  (ID - 1) * WIDTH * LINES, or from pixel 0 if it has no ID. Other
+ *  commands sent to HOST_ID_BROADCAST are taken by all boards.
+ */
+
+/* HOST_RECT updates part of the staged frame; the rest of the staged frame
+ *  is carried over from the last frame flipped, unless it was already
+ *  written after that flip. HOST_RECT data has the following structure,
+ *  0000: Left column and top line (see HOST_RECT_POSITION)
+ *  0002: Width and height (see HOST_RECT_SIZE)
+ *  0004: First pixel of first row
+ *  ....
+ *  Rows are given in the same order as in HOST_FRAME, with each row having
+ *  width pixels. A single line is a rectangle of full width and height 1.
+ *  HOST_FRAME data following HOST_RECT starts again from the first line.
+ */
+#define HOST_RECT_POSITION(x, y) \
+    ((((x) & 0xff) << 8) | ((y) & 0xff))
+#define HOST_RECT_SIZE(width, height) \
+    ((((width) & 0xff) << 8) | ((height) & 0xff))
+
+/* HOST_PACKED stages pixels like HOST_FRAME, but as indices into a palette.
+ *  HOST_PACKED data has the following structure,
+ *  0000: Format and number of palette colors (see HOST_PACKED_HEADER)
+ *  0002: First palette color
+ *  ....
+ *  ....: First packed word
+ *  ....
+ *  HOST_PACKED_INDEX2 words hold 8 pixels, and HOST_PACKED_INDEX4 words hold
+ *  4 pixels, starting from the least significant bits. HOST_PACKED_RUN
+ *  words hold a run length in the high byte and an index in the low byte.
+ */
+#define HOST_PACKED_COLORS  16
+#define HOST_PACKED_HEADER(format, colors) \
+    ((((format) & 0xff) << 8) | ((colors) & 0xff))
+#define HOST_PACKED_RUN_WORD(length, index) \
+    ((((length) & 0xff) << 8) | ((index) & 0xff))
+
+enum HOST_PACKED_FORMAT {
+    HOST_PACKED_INDEX2,
+    HOST_PACKED_INDEX4,
+    HOST_PACKED_RUN
+};
+
+/* HOST_PLANES stages lines as bit-planes, encoded by the host the same way
+ *  the board encodes HOST_FRAME pixels. HOST_PLANES data has the following
+ *  structure,
+ *  0000: Planes per line; planes beyond the bit depth of the profile are
+ *        not shown
+ *  0002: Plane 0 of first line
+ *  0004: Plane 1 of first line
+ *  ....
+ *  Lines are given in the same order as in HOST_FRAME. Each plane is one
+ *  word per driver of the line (LINE_WORDS in defs.h), and bit
+ *  CHANNELS * x + c of a word is bit p of the gamma corrected level of
+ *  channel c of pixel x of that driver, HOST_GAMMA unless the gamma table
+ *  was changed (see HOST_TABLE). With the 8x8 red and green panel,
+ *  bit 2 * x of plane p is the red of pixel x and bit 2 * x + 1 the green.
+ *  Planes not given are zero.
+ */
+#define HOST_GAMMA(level, bits) \
+    ((((level) + 1) * ((level) + 1) - 1) >> (16 - (bits)))
+
+// Frames per second rendered by the board itself, for HOST_WIDGET and
+//  HOST_SET_FADE
+#define HOST_RENDER_RATE    50
+
+/* HOST_SET data has the following structure,
+ *  0000: Setting (see HOST_SETTING)
+ *  0002: Value of setting
+ */
+enum HOST_SETTING {
+    // Bit depth profile of frames staged after this (see PROFILE_BITS);
+    //  each bit less doubles the refresh rate
+    HOST_SET_PROFILE,
+    // What HOST_FLIP does while a flipped frame waits for the scan to end,
+    //  see HOST_FLIP_POLICY
+    HOST_SET_FLIP,
+    // Lines scanned in frames flipped after this, see HOST_SCAN
+    HOST_SET_SCAN,
+    // Frames of HOST_RENDER_RATE over which HOST_FLIP fades from the frame
+    //  flipped last to the staged frame, or 0 to flip at once. A flip
+    //  during a fade fades on from the frame shown; frames with lines from
+    //  HOST_PLANES are flipped at once
+    HOST_SET_FADE,
+    // Bits of precision added to the levels of frames staged after this,
+    //  0 to 3 (DITHER_BITS in defs.h); a frame already partly staged keeps
+    //  the setting it was started with. While such a frame is shown, the
+    //  board stages it again for each scan, carrying the rounding error of
+    //  each channel over to the next scan. Frames with lines from
+    //  HOST_PLANES are not dithered
+    HOST_SET_DITHER,
+    // Entry of a calibration table written by the next HOST_TABLE, see
+    //  HOST_TABLE_CURSOR
+    HOST_SET_TABLE,
+    // Brightness of the panel, in steps of 1 / HOST_BRIGHTNESS_FULL of the
+    //  current set by HOST_IREF. Below HOST_BRIGHTNESS_FULL, BLANK is
+    //  asserted for the start of every timer interval, so that levels keep
+    //  their bit depth; an interval is lit for at most its length less the
+    //  time to shift a line into the drivers, and not at all if that leaves
+    //  less than DIM_TIMER_LATENCY
+    HOST_SET_BRIGHTNESS,
+    // Frames of HOST_RENDER_RATE over which HOST_SET_BRIGHTNESS fades from
+    //  the brightness shown to its level, or 0 to set it at once. The board
+    //  steps the fade by itself, also while it parses host commands
+    HOST_SET_BRIGHTNESS_FADE,
+    // Restart the scan at the first line of the frame shown, as the scan
+    //  with this number. Boards that parse the same broadcast scan in step
+    //  from then on, given the same profile and HOST_SCAN_ALL; they run on
+    //  their own clocks, so the host syncs them again before each
+    //  HOST_SET_FLIP_AT
+    HOST_SET_SYNC,
+    // Number of the first scan that shows frames flipped, see
+    //  HOST_SET_SYNC; until then the frame shown stays, and a board that
+    //  is blanked or dark keeps scanning. Numbers wrap at 16 bits, and
+    //  numbers up to 0x8000 scans ahead are waited for
+    HOST_SET_FLIP_AT,
+    // What the next HOST_STATUS reports, HOST_STATUS_COUNTERS or
+    //  HOST_STATUS_CYCLES plus a section
+    HOST_SET_STATUS
+};
+
+#define HOST_BRIGHTNESS_SHIFT   8
+#define HOST_BRIGHTNESS_FULL    (1 << HOST_BRIGHTNESS_SHIFT)
+
+/* HOST_TABLE writes one entry of a calibration table and moves on to the
+ *  next entry, so that a table is written by HOST_SET_TABLE followed by
+ *  HOST_TABLE for each entry. Tables apply to pixels staged after them.
+ *  The gamma table of a channel maps each level of 8 bits to a level of
+ *  16 bits, HOST_GAMMA(level, 16) by default; scaling a table balances
+ *  white. The scale table of a channel holds a factor for each pixel of
+ *  the frame, in the order of HOST_FRAME, for dot correction; scales
+ *  above HOST_TABLE_SCALE_ONE are taken as HOST_TABLE_SCALE_ONE.
+ *  Channels of RGB565 pixels are widened to 8 bits by repeating their top
+ *  bits below them.
+ */
+#define HOST_TABLE_CURSOR(table, channel, index) \
+    ((((table) & 0xf) << 12) | (((channel) & 0xf) << 8) | ((index) & 0xff))
+#define HOST_TABLE_SCALE_ONE    0x8000
+
+enum HOST_TABLE_ID {
+    HOST_TABLE_GAMMA,
+    HOST_TABLE_SCALE
+};
+
+/* HOST_WIDGET sets one field of a segment of a widget that the board
+ *  renders itself, so that a health bar takes a few words per change
+ *  instead of a stream of frames. HOST_WIDGET data has the following
+ *  structure,
+ *  0000: Segment and field (see HOST_WIDGET_WORD)
+ *  0002: Value of field (see HOST_WIDGET_FIELD)
+ *  Segments are drawn in order over a dark frame. Once the board has
+ *  parsed the words received so far, it renders and flips a frame if any
+ *  segment changed, and renders again at HOST_RENDER_RATE while a segment
+ *  has an effect. Frames from the host are shown until the next render;
+ *  removing the last segment renders a dark frame and stops rendering.
+ */
+#define HOST_WIDGET_SEGMENTS    8
+#define HOST_WIDGET_WORD(segment, field) \
+    ((((segment) & 0xff) << 8) | ((field) & 0xff))
+#define HOST_WIDGET_EFFECT_WORD(effect, period) \
+    ((((effect) & 0xff) << 8) | ((period) & 0xff))
+
+enum HOST_WIDGET_FIELD {
+    // Left column and top line (see HOST_RECT_POSITION), and width and
+    //  height (see HOST_RECT_SIZE) of the segment; a segment is drawn
+    //  while it is not empty and lies within the panel
+    HOST_WIDGET_POSITION,
+    HOST_WIDGET_SIZE,
+    // Pixel of the filled part, and of the rest of the segment
+    HOST_WIDGET_COLOR,
+    HOST_WIDGET_BACK,
+    // Filled part of the width from the left, 0 to 0xffff for all of it;
+    //  the pixel at the edge mixes both colors
+    HOST_WIDGET_FILL,
+    // Effect and its period in frames (see HOST_WIDGET_EFFECT_WORD)
+    HOST_WIDGET_EFFECT
+};
+
+enum HOST_WIDGET_EFFECT {
+    HOST_WIDGET_STILL,
+    // Brightness falls to a quarter and back once per period
+    HOST_WIDGET_PULSE,
+    // Dark for the second half of each period
+    HOST_WIDGET_BLINK,
+    // The filled part wraps around and moves right by the width of the
+    //  segment once per period, for progress of unknown length
+    HOST_WIDGET_MARQUEE
+};
+
+/* HOST_FLIP never waits for the scan; a frame flipped before the last one
+ *  is shown is either replaced by it (HOST_FLIP_NEWEST), or kept with the
+ *  new frame dropped (HOST_FLIP_QUEUE). Either way the frame that is not
+ *  shown is counted as dropped.
+ */
+enum HOST_FLIP_POLICY {
+    HOST_FLIP_NEWEST,
+    HOST_FLIP_QUEUE
+};
+
+/* HOST_SCAN_LIT leaves lines without any lit LED out of the scan, so the
+ *  other lines are refreshed more often. A frame with n lines lit is then
+ *  scanned in n / LINES of the time, and shown at n / LINES of
+ *  HOST_SET_BRIGHTNESS so that its LEDs keep their brightness; as with any
+ *  brightness below full, the shortest intervals may be left dark. A dark
+ *  frame is scanned in full.
+ */
+enum HOST_SCAN {
+    HOST_SCAN_ALL,
+    HOST_SCAN_LIT
 };
 
+/* Boards stop scanning while blanked (HOST_BLANK_OFF) or showing a dark
+ *  frame, and start again from the first line on the HOST_BLANK or
+ *  HOST_FLIP that makes them visible.
+ */
 enum HOST_COMMAND_BLANK {
     HOST_BLANK_ON,
     HOST_BLANK_OFF
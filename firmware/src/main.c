@@ -9,6 +9,7 @@
  */
 
 //#define DEMO
+//#define CYCLE_STATS
 
 #ifdef __USE_CMSIS
 #include "LPC11Exx.h"
@@ -30,97 +31,411 @@ __CRP const unsigned int CRP_WORD = CRP_NO_CRP;
 #include "defs.h"
 #include "conf.h"
 #include "host.h"
+#include "program.h"
 
-static line_t g_buffers[BUFFERS][LINES][PROGRAM_SIZE];
-static line_t (*g_frame)[LINES][PROGRAM_SIZE];
-static line_t (*g_stage)[LINES][PROGRAM_SIZE];
-static line_t *g_frame_line;
+static line_t g_buffers[BUFFERS][LINES][FRAME_LINE_SIZE];
+static line_t (*g_stage)[LINES][FRAME_LINE_SIZE];
+static const line_t *g_frame_line;
+static uintptr_t g_frame_entry[LINE_WORDS];  // Program entry to send next
 static line_t *g_stage_line;
+static uintptr_t g_stage_keep[LINE_WORDS]; // Channels kept from last frame
+static bool g_stage_fresh;      // Nothing written since the last flip
+static size_t g_stage_profile;
+static uintptr_t g_stage_bits;
+static const plane_pair_t *g_stage_first;
+static uintptr_t g_stage_scan;
+static uintptr_t g_stage_dither;    // Bits added by dithering
+static uintptr_t g_next_dither;     // Same for frames staged after a flip
 
-static volatile bool g_switch_buffer;
-static volatile size_t g_frame_index;
+static volatile size_t g_frame_index;    // Buffer shown, set by the timer
+static volatile size_t g_frame_ready;    // Buffer flipped last, shown next
 static size_t g_stage_index;
+static uintptr_t g_flip_policy;
+static uintptr_t g_flip_dropped;
+#ifdef HOST_MISO
+static volatile uintptr_t g_frame_shown;
+#endif
+
+// Number of the scan shown (see HOST_SET_SYNC), and the scan that frames
+//  flipped wait for while g_flip_held (see HOST_SET_FLIP_AT)
+static volatile uintptr_t g_scan_number;
+static uintptr_t g_flip_scan;
+static volatile bool g_flip_held;
+
+// Timer programs of each buffer, for the profile it was staged with
+static const program_interval_t *g_program_interval[BUFFERS];
+static const program_step_t *g_program_schedule[BUFFERS];
+static uintptr_t g_program_length[BUFFERS];
+static size_t g_program_profile[BUFFERS];
+static const program_interval_t *g_frame_program;
+static const program_interval_t *g_frame_interval;
+static const program_interval_t *g_frame_interval_end;
+static const program_step_t *g_frame_schedule;
+static const program_step_t *g_frame_step;
+
+// Lines of each buffer in scan order (see HOST_SET_SCAN), read from the
+//  end down to NULL, and the CSEL pins to toggle after each of them; the
+//  toggle after the last line selects line 0, and the toggle from line 0
+//  to the first line is kept apart
+static const line_t *g_scan_line[BUFFERS][LINES + 1];
+static uintptr_t g_scan_csel[BUFFERS][LINES];
+static uintptr_t g_scan_enter[BUFFERS];
+static uintptr_t g_scan_length[BUFFERS];
+static bool g_scan_dark[BUFFERS];
+static uintptr_t g_scan_share[BUFFERS]; // Of full brightness, for its lines
+static bool g_scan_refresh[BUFFERS];    // Staged again for each scan
+static const line_t *const *g_frame_scan;
+static const uintptr_t *g_frame_csel;
 
-static uintptr_t g_program_interval[PROGRAM_SIZE];
-static uintptr_t g_program_pos[PROGRAM_SIZE - 1];
-static uintptr_t g_program_bit[PROGRAM_SIZE - 1];
-static uintptr_t *g_frame_interval;
+// The timer is stopped, with its clock and the SSP0 clock gated, while
+//  BLANK is asserted or the frame shown is dark
+static volatile bool g_driver_idle;
+static bool g_driver_blank;
 
-static uintptr_t g_program_csel[LINES];
-static uintptr_t *g_frame_csel;
+// Global brightness (see HOST_SET_BRIGHTNESS), and that of the scan shown,
+//  which is lowered for lines left out of it (see HOST_SCAN_LIT); below
+//  HOST_BRIGHTNESS_FULL, the timer asserts BLANK at each interval and
+//  CT16B0 releases it
+static volatile uintptr_t g_driver_brightness;
+static uintptr_t g_frame_brightness;
+static uintptr_t g_driver_latch;    // Core cycles to shift a line out
+static uintptr_t g_driver_tick;     // Core cycles per driver timer count
+
+// Brightness fade, stepped by the render timer
+static uintptr_t g_brightness_frames;   // Length of the next fades
+static uintptr_t g_brightness_length;   // Length of the fade running
+static uintptr_t g_brightness_start;    // g_render_frame when it started
+static uintptr_t g_brightness_from;
+static uintptr_t g_brightness_to;
+static bool g_brightness_active;
 
 #define COMMAND_LENGTH_VARIABLE    UINTPTR_MAX
 
 static enum HOST_COMMAND g_command;
 static uintptr_t g_command_length;
+static uintptr_t g_command_size;
 static uintptr_t g_command_id;
+static uintptr_t g_command_skip;    // Words of a broadcast for other boards
+static uintptr_t g_broadcast_start; // Slice of a broadcast for this board
+static uintptr_t g_broadcast_end;
+static uintptr_t g_command_setting;
+#ifdef HOST_MISO
+static volatile uintptr_t g_host_overruns;
+static volatile uintptr_t g_status_words;   // Not yet read by the host
+static uintptr_t g_status_page;     // See HOST_SET_STATUS
+static uintptr_t g_host_bad_frames;
+#endif
+
+// Host words from SSP1 to PendSV; each index is written by one side only
+static volatile HOST_DATA g_host_ring[HOST_RING_SIZE];
+static volatile uintptr_t g_host_ring_head;     // Written by SSP1
+static volatile uintptr_t g_host_ring_tail;     // Written by PendSV
+static volatile uintptr_t g_host_ring_high;     // Most words waiting at once
+
+#ifdef HOST_FRAMED
+#if HOST_RING_SIZE < HOST_FRAMED_WORDS + 3
+#error HOST_RING_SIZE must hold a whole frame
+#endif
+static bool g_framed_lost;  // Skipping frames that continue a command
+#endif
+
+static plane_pair_t g_src_line[LINE_WORDS][PLANE_PAIRS];
+static plane_pair_t *g_src_word;    // Driver of the next pixel
+static uintptr_t g_src_pixels;      // Pixels left for that driver
+
+static uintptr_t g_rect_x;
+static uintptr_t g_rect_y;
+static uintptr_t g_rect_width;
+static uintptr_t g_rect_column;
+static uintptr_t g_rect_pixels;
+
+static uintptr_t g_planes_count;    // Words per line of HOST_PLANES
+static uintptr_t g_planes_index;
+
+// Pixels of the staged frame and of the frame flipped last, kept for fades;
+//  frames with lines from HOST_PLANES have no pixels
+static pixel_t g_pixels[2][LINES * WIDTH];
+static pixel_t *g_stage_pixels;
+static pixel_t *g_stage_pixel;      // Pixel of the next SetFrameData
+static bool g_stage_planes;
+static pixel_t *g_ready_pixels;
+static bool g_ready_planes;
+static bool g_ready_refresh;        // Staged again from the frame shown
+
+// Rounding error of each channel, carried to the next time it is staged
+static uint8_t g_dither_error[LINES * WIDTH][CHANNELS];
+
+// Calibration tables, see HOST_TABLE
+static uint16_t g_gamma_table[CHANNELS][256];
+static uint16_t g_pixel_scale[LINES * WIDTH][CHANNELS];
+static bool g_pixel_scaled;         // A scale was set below one
+static uintptr_t g_table_cursor;
+
+// Fade between two frames, see HOST_SET_FADE
+static pixel_t g_fade_from[LINES * WIDTH];
+static pixel_t g_fade_to[LINES * WIDTH];
+static uintptr_t g_fade_frames;     // Length of the next fades
+static uintptr_t g_fade_length;     // Length of the fade running
+static uintptr_t g_fade_start;      // g_render_frame when it started
+static uintptr_t g_fade_step;       // Frames of it rendered
+static bool g_fade_active;
+
+static pixel_t g_packed_palette[HOST_PACKED_COLORS];
+static uintptr_t g_packed_format;
+static uintptr_t g_packed_colors;
+
+// Segments of the widget rendered by the board, see HOST_WIDGET
+typedef struct {
+    uint8_t x;
+    uint8_t y;
+    uint8_t width;
+    uint8_t height;
+    bool drawn;         // Not empty and within the panel
+    pixel_t color;
+    pixel_t back;
+    uint16_t fill;
+    uint8_t effect;
+    uint8_t period;
+} widget_segment_t;
+
+static widget_segment_t g_widget_segments[HOST_WIDGET_SEGMENTS];
+static uintptr_t g_widget_field;
+static bool g_widget_changed;       // Render even if no frame has passed
+static bool g_widget_animated;      // A segment has an effect
+static uintptr_t g_widget_rendered; // Frame of the last render
+
+// Frames rendered by the board, see HOST_RENDER_RATE
+static bool g_render_timer;         // CT32B1 counts frames
+static volatile uintptr_t g_render_frame;   // Frames counted by CT32B1
+
+#ifdef CYCLE_STATS
+// Core clock cycles spent in the code below, for reading from a debugger
+//  or over MISO (see HOST_STATUS_CYCLES); cycles of interrupts taken
+//  meanwhile are included
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;     // Average is total / count
+} cycle_stats_t;
+
+static volatile cycle_stats_t g_cycle_stats[HOST_CYCLES_SECTIONS];
+// Timer interrupts taken a tick or more after the match,
+//  which lengthens the interval that just ended
+static volatile uint32_t g_cycle_timer_late;
+#endif
+
+#ifdef CYCLE_STATS
+static void
+InitCycles(void)
+{
+    intptr_t i;
+    for (i = 0; i < HOST_CYCLES_SECTIONS; ++i) {
+        g_cycle_stats[i].count = 0;
+        g_cycle_stats[i].min = UINT32_MAX;
+        g_cycle_stats[i].max = 0;
+        g_cycle_stats[i].total = 0;
+    }
+    g_cycle_timer_late = 0;
+
+    // Free-running 24-bit down counter at the core clock
+    SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+static void
+EndCycles(uintptr_t index, uint32_t start)
+{
+    uint32_t cycles = (start - SysTick->VAL) & SysTick_LOAD_RELOAD_Msk;
+    volatile cycle_stats_t *stats = &g_cycle_stats[index];
+    stats->count++;
+    stats->total += cycles;
+    if (cycles < stats->min) {
+        stats->min = cycles;
+    }
+    if (cycles > stats->max) {
+        stats->max = cycles;
+    }
+}
 
-static gamma_pixel_t g_src_buffers[SRC_BUFFERS][WIDTH];
-static gamma_pixel_t (*g_src_program_line)[WIDTH];
-static gamma_pixel_t *g_src_incoming_pixel;
-static uintptr_t g_src_program_index;
+#define CYCLES_BEGIN()      uint32_t cycles_start = SysTick->VAL
+#define CYCLES_END(index)   EndCycles(index, cycles_start)
+#else
+#define CYCLES_BEGIN()
+#define CYCLES_END(index)
+#endif
 
 static void
 InitFrame(void)
 {
+    intptr_t i;
+
     g_frame_index = 0;
-    g_frame = &g_buffers[g_frame_index];
-    g_frame_line = (*g_frame)[LINES];
+    g_scan_number = 0;
+    g_flip_held = false;
     g_stage_index = 1;
     g_stage = &g_buffers[g_stage_index];
-    g_stage_line = (*g_stage)[LINES];
-    g_switch_buffer = false;
+    g_stage_line = (*g_stage)[0];
+    for (i = 0; i < LINE_WORDS; ++i) {
+        g_stage_keep[i] = 0;
+    }
+    g_stage_fresh = true;
+    g_stage_pixels = g_stage_pixel = g_pixels[0];
+    g_stage_planes = false;
+    g_ready_pixels = g_pixels[1];
+    g_ready_planes = false;
+    g_ready_refresh = false;
+    g_stage_dither = g_next_dither = 0;
+    for (i = 0; i < BUFFERS; ++i) {
+        g_scan_refresh[i] = false;
+    }
+    // Spread the errors so that neighbouring channels do not step up on
+    //  the same scan
+    for (i = 0; i < LINES * WIDTH * CHANNELS; ++i) {
+        g_dither_error[i / CHANNELS][i % CHANNELS] =
+                (uint8_t)((i * 5) & ((1 << DITHER_BITS) - 1));
+    }
+    g_frame_ready = g_frame_index;
+    g_flip_policy = HOST_FLIP_NEWEST;
+    g_fade_frames = 0;
+    g_fade_active = false;
+    g_flip_dropped = 0;
+#ifdef HOST_MISO
+    g_frame_shown = 0;
+#endif
+}
+
+static void
+InitTables(void)
+{
+    intptr_t i, j;
+    for (i = 0; i < CHANNELS; ++i) {
+        for (j = 0; j < 256; ++j) {
+            g_gamma_table[i][j] = (uint16_t)HOST_GAMMA(j, 16);
+        }
+    }
+    for (i = 0; i < LINES * WIDTH; ++i) {
+        for (j = 0; j < CHANNELS; ++j) {
+            g_pixel_scale[i][j] = HOST_TABLE_SCALE_ONE;
+        }
+    }
+    g_pixel_scaled = false;
+    g_table_cursor = 0;
 }
 
 static void
 InitSource(void)
 {
-    g_src_program_line = &g_src_buffers[SRC_BUFFERS - 1];
-    g_src_incoming_pixel = *g_src_program_line;
-    g_src_program_index = 0;
+    g_src_word = g_src_line[0];
+    g_src_pixels = DRIVER_PIXELS;
 }
 
 static void
-InitProgram(void)
+SetProgram(size_t index)
+{
+    // Select the program of g_stage_profile, for staging into buffer index
+    const uintptr_t bits = PROFILE_BITS[g_stage_profile];
+    const uintptr_t length = PROGRAM_LENGTH(bits);
+
+    g_program_interval[index] = PROGRAM_INTERVAL[bits];
+    g_program_schedule[index] = PROGRAM_SCHEDULE[bits];
+    g_program_length[index] = length;
+    g_program_profile[index] = g_stage_profile;
+
+    g_stage_first = PROGRAM_FIRST[bits];
+    g_stage_bits = bits;
+}
+
+static void
+SetScan(size_t index)
 {
+    // Build the scan of buffer index before it is flipped
     intptr_t i, j;
-    size_t program_index = 0;
-    for (i = 1; i < BITS; ++i) {
-        for (j = i - 1; j >= 0; --j) {
-            g_program_interval[PROGRAM_SIZE - program_index - 2] =
-                    ((j == 0) ? 1 : (1 << (j - 1))) * 2 - 1;
-            g_program_pos[program_index] = CHANNELS * WIDTH - j - 1;
-            g_program_bit[program_index] = (1 << i);
-            program_index++;
+    uintptr_t lit = 0;
+    uintptr_t csel;
+    size_t length = 0;
+
+    for (i = LINES - 1; i >= 0; --i) {
+        const line_t *line = g_buffers[index][i];
+        uintptr_t on = 0;
+        for (j = FRAME_FIRST - 1; j >= 0; --j) {
+            on |= line[j];
         }
+        lit = (lit << 1) | !!on;
+    }
+    g_scan_dark[index] = !lit;
+    if (!lit || g_stage_scan != HOST_SCAN_LIT) {
+        lit = (1 << LINES) - 1;
+    }
+    if (lit == (1 << LINES) - 1 && g_scan_length[index] == LINES) {
+        return;
     }
-    for (i = BITS - 1; i > 0; --i) {
-        for (j = 0; j < i; ++j) {
-            g_program_interval[PROGRAM_SIZE - program_index - 2] =
-                    ((j + 1 == i) ? 1 : (1 << j)) * 2 - 1;
-            g_program_pos[program_index] = CHANNELS * WIDTH - i - 1;
-            g_program_bit[program_index] = (1 << j);
-            program_index++;
+
+    csel = PROGRAM_CSEL_LINE[0];
+    g_scan_line[index][0] = NULL;
+    for (i = LINES - 1; i >= 0; --i) {
+        if (lit & (1 << i)) {
+            g_scan_csel[index][length] = csel ^ PROGRAM_CSEL_LINE[i];
+            g_scan_line[index][++length] = g_buffers[index][i];
+            csel = PROGRAM_CSEL_LINE[i];
         }
     }
-    g_program_interval[PROGRAM_SIZE - 1] = 1;
-    g_frame_interval = &g_program_interval[PROGRAM_SIZE];
+    g_scan_enter[index] = csel ^ PROGRAM_CSEL_LINE[0];
+    g_scan_length[index] = length;
+    // Each line is shown for length / LINES of the time of a full scan
+    g_scan_share[index] = (length << HOST_BRIGHTNESS_SHIFT) / LINES;
+}
 
-    for (i = 0; i < LINES; ++i) {
-#if LINES != 8
-#error Change sequence below
-#endif
-        intptr_t xor = LINE_SEQUENCE[i] ^ LINE_SEQUENCE[i + 1];
-#define MAKE_CSEL(n)    ((!!(xor & (1 << (n)))) << (CSEL ## n ## _PIN))
-        g_program_csel[i] = MAKE_CSEL(0) | MAKE_CSEL(1) | MAKE_CSEL(2);
-#undef MAKE_CSEL
+ALWAYS_INLINE
+static void
+LoadFrameEntry(void)
+{
+    intptr_t i;
+    for (i = LINE_WORDS - 1; i >= 0; --i) {
+        g_frame_entry[i] = g_frame_line[FRAME_FIRST + i];
+    }
+}
+
+ALWAYS_INLINE
+static void
+SendFrameEntry(void)
+{
+    // The first word shifts through to the last driver of the chain
+    intptr_t i;
+    for (i = LINE_WORDS - 1; i >= 0; --i) {
+        LPC_SSP0->DR = (uint32_t)g_frame_entry[i];
+    }
+}
+
+static void
+InitProgram(void)
+{
+    intptr_t i;
+
+    g_stage_profile = 0;
+    g_stage_scan = HOST_SCAN_ALL;
+    for (i = 0; i < BUFFERS; ++i) {
+        SetScan(i);
+    }
+    for (i = 0; i < BUFFERS; ++i) {
+        SetProgram(ROUND_BUFFER_INDEX(g_stage_index + 1 + i));
     }
+    g_frame_program = g_program_interval[g_frame_index];
+    g_frame_interval = g_frame_interval_end =
+            &g_frame_program[g_program_length[g_frame_index]];
+    g_frame_schedule = g_frame_step = g_program_schedule[g_frame_index];
+
     for (i = 1; i < LINES; ++i) {
         if (LINE_SEQUENCE[i] == 0) {
             break;
         }
     }
-    g_frame_csel = &g_program_csel[i];
+    // Start from the line selected by CSEL pins all low
+    g_frame_csel = &g_scan_csel[g_frame_index][i];
+    g_frame_scan = &g_scan_line[g_frame_index][i];
+    g_frame_line = *g_frame_scan;
+    LoadFrameEntry();
 }
 
 static void
@@ -159,17 +474,113 @@ InitHostSPI(void)
     // /CS
     LPC_IOCON->CS_PIO = IOCon_Digital(IOCON_FUNC_2, IOCON_MODE_INACTIVE,
             IOCON_HYS_DISABLED, IOCON_INV_NORMAL, IOCON_OD_DISABLED);
+#ifdef HOST_MISO
+    // MISO, driven only while status is read
+    LPC_IOCON->MISO_PIO = IOCon_Digital(IOCON_FUNC_2, IOCON_MODE_INACTIVE,
+            IOCON_HYS_DISABLED, IOCON_INV_NORMAL, IOCON_OD_DISABLED);
+#endif
 
     NVIC_SetPriority(SSP1_IRQn, NVIC_PRIO_HOST_SSP);
     NVIC_ClearPendingIRQ(SSP1_IRQn);
     NVIC_EnableIRQ(SSP1_IRQn);
 }
 
+static void
+SetBroadcastSlice(void)
+{
+    uintptr_t index = g_command_id ? g_command_id - 1 : 0;
+    g_broadcast_start = index * WIDTH * LINES;
+    g_broadcast_end = g_broadcast_start + WIDTH * LINES;
+}
+
 static void
 InitHostCommand(void) {
     g_command = HOST_NOP;
     g_command_id = 0;
+    g_command_skip = 0;
+    SetBroadcastSlice();
+#ifdef HOST_MISO
+    g_host_overruns = 0;
+    g_status_words = 0;
+    g_status_page = HOST_STATUS_COUNTERS;
+    g_host_bad_frames = 0;
+#endif
+    g_host_ring_head = g_host_ring_tail = 0;
+    g_host_ring_high = 0;
+#ifdef HOST_FRAMED
+    // The host may be partway through a command
+    g_framed_lost = true;
+#endif
+    NVIC_SetPriority(PendSV_IRQn, NVIC_PRIO_HOST_PARSE);
+}
+
+#ifdef HOST_MISO
+static void
+SetStatusOutput(enum SSP_SOD sod)
+{
+    LPC_SSP1->CR1 = SSP_CR1(SSP_LBM_NORMAL, SSP_SSE_ENABLED,
+            SSP_MS_SLAVE, sod);
+}
+
+// Dummy array to detect a status longer than the SSP1 transmit FIFO,
+//  which SendStatus fills at once
+static const uintptr_t STATUS_DUMMY[SSP_FIFO_SIZE - HOST_STATUS_WORDS];
+
+ALWAYS_INLINE
+static uintptr_t
+CycleWord(uint64_t cycles)
+{
+    return cycles < HOST_DATA_MASK ? (uintptr_t)cycles : HOST_DATA_MASK;
+}
+
+static void
+SendCycles(uintptr_t section)
+{
+#ifdef CYCLE_STATS
+    cycle_stats_t stats = { 0, 0, 0, 0 };
+    uint32_t late;
+    // Copied at once, as the timer interrupts update them
+    __disable_irq();
+    if (section < HOST_CYCLES_SECTIONS) {
+        stats = g_cycle_stats[section];
+    }
+    late = g_cycle_timer_late;
+    __enable_irq();
+    LPC_SSP1->DR = section;
+    LPC_SSP1->DR = (HOST_DATA)stats.count;
+    LPC_SSP1->DR = stats.count ? CycleWord(stats.min) : 0;
+    LPC_SSP1->DR = stats.count ? CycleWord(stats.total / stats.count) : 0;
+    LPC_SSP1->DR = CycleWord(stats.max);
+    LPC_SSP1->DR = (HOST_DATA)late;
+#else
+    intptr_t i;
+    LPC_SSP1->DR = section;
+    // No runs, cycles or late interrupts
+    for (i = 2; i < HOST_STATUS_WORDS; ++i) {
+        LPC_SSP1->DR = 0;
+    }
+#endif
+}
+
+static void
+SendStatus(void)
+{
+    // Boards share MISO, so it is only driven until the status is read
+    LPC_SSP1->DR = HOST_VERSION;
+    if (g_status_page & HOST_STATUS_CYCLES) {
+        SendCycles(g_status_page & ~HOST_STATUS_CYCLES);
+    } else {
+        LPC_SSP1->DR = g_frame_ready != g_frame_index && !g_ready_refresh;
+        LPC_SSP1->DR = (HOST_DATA)g_frame_shown;
+        LPC_SSP1->DR = (HOST_DATA)g_flip_dropped;
+        LPC_SSP1->DR = (HOST_DATA)g_host_overruns;
+        LPC_SSP1->DR = (HOST_DATA)g_host_ring_high;
+        LPC_SSP1->DR = (HOST_DATA)g_host_bad_frames;
+    }
+    g_status_words = HOST_STATUS_WORDS;
+    SetStatusOutput(SSP_SOD_NORMAL);
 }
+#endif
 
 static void
 InitDriverSPI(void)
@@ -185,8 +596,17 @@ InitDriverSPI(void)
 
     // Set SSP0 configuration and start SSP0
     LPC_SSP0->CPSR = SystemCoreClock / DRIVER_SPI_CLK;
+#if LINE_WORDS == 1
+    // LED_LATCH (SSEL0) rises after every word
     LPC_SSP0->CR0 = SSP_CR0(
             16, SSP_FRF_SPI, SSP_CPOL_LO, SSP_CPHA_AWAY_FROM, 0);
+#else
+    // SSEL0 stays low while words follow each other only with CPHA set, so
+    //  LED_LATCH rises after the words of all drivers; with CPOL set, data
+    //  still changes on falling edges of LED_SCLK
+    LPC_SSP0->CR0 = SSP_CR0(
+            16, SSP_FRF_SPI, SSP_CPOL_HI, SSP_CPHA_BACK_TO, 0);
+#endif
     LPC_SSP0->CR1 = SSP_CR1(
             SSP_LBM_NORMAL, SSP_SSE_ENABLED, SSP_MS_MASTER,
             SSP_SOD_NORMAL);
@@ -202,6 +622,21 @@ InitDriverSPI(void)
             IOCON_HYS_DISABLED, IOCON_INV_NORMAL, IOCON_OD_DISABLED);
 }
 
+static void
+StartDriverTimer(void)
+{
+    // A match of the timer before this is no longer due
+    LPC_CT32B0->IR = CT32B0_IR_MR0INT;
+    NVIC_ClearPendingIRQ(TIMER_32_0_IRQn);
+    LPC_CT32B0->MR0 = 1;
+    LPC_CT32B0->PC = 0;
+    // Set timer to run at DRIVER_LINE_CLK
+    LPC_CT32B0->PR = SystemCoreClock / DRIVER_LINE_CLK / 2 - 1;
+    LPC_CT32B0->TC = 0;
+    LPC_CT32B0->TCR = CT32B0_TCR(CT32B0_CEN_ENABLED, CT32B0_CRST_RESET);
+    LPC_CT32B0->TCR = CT32B0_TCR(CT32B0_CEN_ENABLED, CT32B0_CRST_NORMAL);
+}
+
 static void
 InitDriverTimer(void)
 {
@@ -215,14 +650,23 @@ InitDriverTimer(void)
     NVIC_EnableIRQ(TIMER_32_0_IRQn);
 
     LPC_CT32B0->MCR = CT32B0_MCR_MR0I | CT32B0_MCR_MR0R | CT32B0_MCR_MR1R;
-    LPC_CT32B0->MR0 = 1;
     LPC_CT32B0->MR1 = (1 << (BITS - 1)) * 2; // safeguard
-    LPC_CT32B0->PC = 0;
-    // Set timer to run at DRIVER_LINE_CLK
-    LPC_CT32B0->PR = SystemCoreClock / DRIVER_LINE_CLK / 2 - 1;
-    LPC_CT32B0->TC = 0;
-    LPC_CT32B0->TCR = CT32B0_TCR(CT32B0_CEN_ENABLED, CT32B0_CRST_RESET);
-    LPC_CT32B0->TCR = CT32B0_TCR(CT32B0_CEN_ENABLED, CT32B0_CRST_NORMAL);
+    g_driver_idle = false;
+    StartDriverTimer();
+}
+
+static void
+InitDimTimer(void)
+{
+    // CT16B0 is only clocked below full brightness, see SetDriverBrightness
+    NVIC_SetPriority(TIMER_16_0_IRQn, NVIC_PRIO_DIM_TIMER);
+    NVIC_ClearPendingIRQ(TIMER_16_0_IRQn);
+    NVIC_EnableIRQ(TIMER_16_0_IRQn);
+    g_driver_brightness = g_frame_brightness = HOST_BRIGHTNESS_FULL;
+    g_brightness_frames = 0;
+    g_brightness_active = false;
+    g_driver_latch = LINE_WORDS * 16 * (SystemCoreClock / DRIVER_SPI_CLK);
+    g_driver_tick = SystemCoreClock / DRIVER_LINE_CLK / 2;
 }
 
 static void
@@ -285,6 +729,7 @@ InitDriverSignals(void)
 
     // BLANK
     setGPIO(BLANK_PORT, BLANK_PIN, GPIO_HI);
+    g_driver_blank = true;
     setGPIODir(BLANK_PORT, BLANK_PIN, GPIO_OUTPUT);
     LPC_IOCON->BLANK_PIO = IOCon_Digital(IOCON_FUNC_0, IOCON_MODE_INACTIVE,
             IOCON_HYS_DISABLED, IOCON_INV_NORMAL, IOCON_OD_DISABLED);
@@ -319,63 +764,194 @@ SetDriverIRef(uintptr_t level)
 #undef SET_IREF
 }
 
+ALWAYS_INLINE
+static void
+SetFrameBrightness(void)
+{
+    // Scale the global brightness by the share of the scan shown
+    uintptr_t level = (g_driver_brightness * g_scan_share[g_frame_index]) >>
+            HOST_BRIGHTNESS_SHIFT;
+
+    if ((level == HOST_BRIGHTNESS_FULL) ==
+            (g_frame_brightness == HOST_BRIGHTNESS_FULL)) {
+        g_frame_brightness = level;
+        return;
+    }
+    g_frame_brightness = level;
+    if (level != HOST_BRIGHTNESS_FULL) {
+        // CT16B0 has the same registers as CT32B0, and stops at its match
+        LPC_SYSCON->SYSAHBCLKCTRL |= SYSAHBCLKCTRL_CT16B0;
+        LPC_CT16B0->IR = CT32B0_IR_MR0INT;
+        LPC_CT16B0->PR = 0;
+        LPC_CT16B0->MCR = CT32B0_MCR_MR0I | CT32B0_MCR_MR0S;
+        return;
+    }
+    LPC_CT16B0->TCR = CT32B0_TCR(CT32B0_CEN_DISABLED, CT32B0_CRST_NORMAL);
+    LPC_CT16B0->IR = CT32B0_IR_MR0INT;
+    LPC_SYSCON->SYSAHBCLKCTRL &= ~SYSAHBCLKCTRL_CT16B0;
+    NVIC_ClearPendingIRQ(TIMER_16_0_IRQn);
+    setGPIO(BLANK_PORT, BLANK_PIN, g_driver_blank);
+}
+
+static void
+SetDriverBrightness(uintptr_t level)
+{
+    if (level > HOST_BRIGHTNESS_FULL) {
+        level = HOST_BRIGHTNESS_FULL;
+    }
+    // The timer sets the brightness of each scan it starts
+    __disable_irq();
+    g_driver_brightness = level;
+    SetFrameBrightness();
+    __enable_irq();
+}
+
+ALWAYS_INLINE
+static void
+StoreSourceLine(void)
+{
+    // Store the bit-planes of the complete line and the first entry of
+    //  its program; the timer builds the other entries from these
+    intptr_t i, j;
+    line_t *line = g_stage_line;
+
+    for (j = LINE_WORDS - 1; j >= 0; --j) {
+        uintptr_t first = 0;
+        uintptr_t keep = g_stage_keep[j];
+        line_t *word = &line[j];
+        for (i = PLANE_PAIRS - 1; i >= 0; --i) {
+            plane_pair_t pair = g_src_line[j][i];
+            line_t *low = &word[i * 2 * LINE_WORDS];
+            line_t *high = &low[LINE_WORDS];
+            first |= pair & g_stage_first[i];
+            *low = (line_t)((pair & ~keep) | (*low & keep));
+            *high = (line_t)(((pair >> 16) & ~keep) | (*high & keep));
+        }
+        first |= first >> 16;
+        word[FRAME_FIRST] = (line_t)((first & ~keep) |
+                (word[FRAME_FIRST] & keep));
+    }
+    line += FRAME_LINE_SIZE;
+    if (line == (*g_stage)[LINES]) {
+        line = (*g_stage)[0];
+        g_stage_pixel = g_stage_pixels;
+    }
+    g_stage_line = line;
+}
+
 static void
 SetFrameData(uintptr_t data)
 {
+    CYCLES_BEGIN();
     intptr_t i;
-    uintptr_t line, shift;
-    gamma_pixel_t pixel;
-    gamma_pixel_t (*src_line)[WIDTH] = g_src_program_line;
-
-    *(g_src_incoming_pixel++) = ~CorrectGamma((pixel_t)data);
-    if (g_src_incoming_pixel > *src_line &&
-            g_src_incoming_pixel <= *(src_line + 1)) {
-        // First line
-        if (g_src_incoming_pixel != *(++src_line)) {
-            return;
+    uintptr_t levels[CHANNELS];
+    uintptr_t shift = 16 - g_stage_bits - g_stage_dither;
+    pixel_t *pixel = g_stage_pixel++;
+    size_t index = pixel - g_stage_pixels;
+
+    *pixel = (pixel_t)data;
+    for (i = 0; i < CHANNELS; ++i) {
+        uintptr_t level = g_gamma_table[i][PixelLevel((pixel_t)data, i)];
+        if (g_pixel_scaled) {
+            level = (level * g_pixel_scale[index][i]) >> 15;
         }
+        levels[i] = DitherLevel(level >> shift, g_stage_bits, g_stage_dither,
+                &g_dither_error[index][i]);
     }
-    if (g_src_incoming_pixel == *src_line ||
-            g_src_incoming_pixel == g_src_buffers[SRC_BUFFERS]) {
-        if (*src_line == g_src_buffers[0]) {
-            src_line = &g_src_buffers[SRC_BUFFERS];
+    TransposePixel(g_src_word, levels);
+    if (!(--g_src_pixels)) {
+        g_src_pixels = DRIVER_PIXELS;
+        if (g_src_word != g_src_line[LINE_WORDS - 1]) {
+            g_src_word += PLANE_PAIRS;
+        } else {
+            g_src_word = g_src_line[0];
+            StoreSourceLine();
         }
-        g_src_program_line = --src_line;
-        g_src_incoming_pixel = *(src_line - 1);
-        if (*src_line == g_src_buffers[0]) {
-            g_src_incoming_pixel = g_src_buffers[SRC_BUFFERS - 1];
+    }
+    CYCLES_END(HOST_CYCLES_SET_FRAME_DATA);
+}
+
+static void
+SetTableData(uintptr_t data)
+{
+    // Write the entry at the cursor and move on to the next one
+    uintptr_t cursor = g_table_cursor;
+    uintptr_t channel = (cursor >> 8) & 0xf;
+    uintptr_t index = cursor & 0xff;
+
+    if (channel >= CHANNELS) {
+        return;
+    }
+    switch (cursor >> 12) {
+    case HOST_TABLE_GAMMA:
+        g_gamma_table[channel][index] = (uint16_t)data;
+        break;
+    case HOST_TABLE_SCALE:
+        if (index >= LINES * WIDTH) {
+            return;
         }
-        // Calculate the first entry of the program
-        line = 0;
-        shift = 0;
-        for (i = CHANNELS * WIDTH - 1; i >= 0; --i) {
-            pixel = (*src_line)[i / 2];
-            pixel = (i & 1) ? (pixel >> 16) : pixel;
-            line |= ((!(pixel & (1 << shift))) << i);
-            shift = (shift == (BITS - 1)) ? 0 : (shift + 1);
+        if (data < HOST_TABLE_SCALE_ONE) {
+            g_pixel_scaled = true;
+        } else {
+            data = HOST_TABLE_SCALE_ONE;
         }
-        g_src_program_index = 0;
-        *(--g_stage_line) = (line_t)line;
-    } else {
-        line = (uintptr_t)*g_stage_line;
-        i = g_src_program_index;
-        shift = PROGRAM_SIZE - i - 1;
-        shift = shift > PROGRAM_STEP ? PROGRAM_STEP : shift;
-        for (; shift; --shift, ++i) {
-            intptr_t pos = g_program_pos[i];
-            intptr_t bit = g_program_bit[i];
-            for (; pos >= 0; pos -= BITS) {
-                pixel = (*src_line)[pos / 2];
-                pixel = (pos & 1) ? (pixel >> 16) : pixel;
-                line = (line & ~(1 << pos)) | ((!(pixel & bit)) << pos);
-            }
-            *(--g_stage_line) = (line_t)line;
+        g_pixel_scale[index][channel] = (uint16_t)data;
+        break;
+    default:
+        return;
+    }
+    g_table_cursor = (cursor & ~0xff) | ((index + 1) & 0xff);
+}
+
+static void
+SetPlaneData(uintptr_t data, uintptr_t offset)
+{
+    intptr_t i, j;
+    uintptr_t index = g_planes_index;
+    uintptr_t shown = g_stage_bits * LINE_WORDS;
+    line_t *line = g_stage_line;
+
+    if (!offset) {
+        // Lines start again from whole lines, like after HOST_FLIP
+        g_planes_count = data * LINE_WORDS;
+        g_planes_index = 0;
+        InitSource();
+        return;
+    }
+    if (!g_planes_count) {
+        return;
+    }
+    g_stage_planes = true;
+    // Planes beyond the bit depth of the profile are not shown
+    if (index < shown) {
+        line[index] = (line_t)data;
+    }
+    if (++index != g_planes_count) {
+        g_planes_index = index;
+        return;
+    }
+    // Complete the line as SetFrameData does
+    g_planes_index = 0;
+    for (i = index < shown ? index : shown; i < FRAME_FIRST; ++i) {
+        line[i] = 0;
+    }
+    for (j = LINE_WORDS - 1; j >= 0; --j) {
+        uintptr_t first = 0;
+        const line_t *word = &line[j];
+        for (i = PLANE_PAIRS - 1; i >= 0; --i) {
+            first |= (word[i * 2 * LINE_WORDS] |
+                    ((plane_pair_t)word[(i * 2 + 1) * LINE_WORDS] << 16)) &
+                    g_stage_first[i];
         }
-        g_src_program_index = i;
+        line[FRAME_FIRST + j] = (line_t)(first | (first >> 16));
     }
-    if (g_stage_line == (*g_stage)[0]) {
-        g_stage_line = (*g_stage)[LINES];
+    line += FRAME_LINE_SIZE;
+    g_stage_pixel += WIDTH;
+    if (line == (*g_stage)[LINES]) {
+        line = (*g_stage)[0];
+        g_stage_pixel = g_stage_pixels;
     }
+    g_stage_line = line;
 }
 
 static void
@@ -390,105 +966,1046 @@ FillFrame(uintptr_t data)
 }
 
 static void
-NextFrame(void)
+CarryFrame(void)
 {
+    // Start the staged frame from the last frame flipped,
+    //  or from a blank frame if it was staged with another profile
     intptr_t i;
-    for (i = WIDTH - 1; i > 0; --i) {
-        SetFrameData(0); // Digest last line received
-    }
-    g_switch_buffer = true;
-    g_stage_index = ROUND_BUFFER_INDEX(g_stage_index + 1);
-    g_stage = &g_buffers[g_stage_index];
-    g_stage_line = (*g_stage)[LINES];
-    InitSource();
-    while (g_stage_index == g_frame_index) {
-        __WFI();
+    size_t index = g_frame_ready;
+    const line_t *src = g_buffers[index][0];
+    line_t *dst = (*g_stage)[0];
+    if (g_program_profile[index] == g_stage_profile) {
+        for (i = LINES * FRAME_LINE_SIZE; i > 0; --i) {
+            *(dst++) = *(src++);
+        }
+        for (i = 0; i < LINES * WIDTH; ++i) {
+            g_stage_pixels[i] = g_ready_pixels[i];
+        }
+        g_stage_planes = g_ready_planes;
+    } else {
+        for (i = LINES * FRAME_LINE_SIZE; i > 0; --i) {
+            *(dst++) = 0;
+        }
+        for (i = 0; i < LINES * WIDTH; ++i) {
+            g_stage_pixels[i] = 0;
+        }
+        g_stage_planes = false;
     }
+    g_stage_fresh = false;
 }
 
-void
-TIMER32_0_IRQHandler(void)
+static void
+EndRect(void)
 {
-    LPC_SSP0->DR = (uint32_t)(*(--g_frame_line));
-    LPC_CT32B0->IR = CT32B0_IR_MR0INT;
-    LPC_CT32B0->TC = (uintptr_t)(-1);
-    LPC_CT32B0->MR0 = (uint32_t)(*(--g_frame_interval));
+    intptr_t i;
+    g_rect_pixels = 0;
+    for (i = 0; i < LINE_WORDS; ++i) {
+        g_stage_keep[i] = 0;
+    }
+    g_stage_line = (*g_stage)[0];
+    g_stage_pixel = g_stage_pixels;
+    InitSource();
+}
 
-    if (g_frame_interval != g_program_interval) {
+static void
+SetRectData(uintptr_t data, uintptr_t offset)
+{
+    uintptr_t i;
+    if (!offset) {
+        EndRect();
+        g_rect_x = (data >> 8) & 0xff;
+        g_rect_y = data & 0xff;
         return;
     }
-    g_frame_interval = &g_program_interval[PROGRAM_SIZE];
-
-#if !(CSEL0_PORT == CSEL1_PORT && CSEL1_PORT == CSEL2_PORT)
-#error CSEL pins must be in same port
-#endif
-    LPC_GPIO->NOT[CSEL0_PORT] = (uint32_t)*(--g_frame_csel);
-    if (g_frame_csel != g_program_csel) {
+    if (offset == 1) {
+        uintptr_t x = g_rect_x;
+        uintptr_t y = g_rect_y;
+        uintptr_t w = (data >> 8) & 0xff;
+        uintptr_t h = data & 0xff;
+        if (!w || !h || x + w > WIDTH || y + h > LINES) {
+            return;
+        }
+        if (g_stage_fresh) {
+            CarryFrame();
+        }
+        g_stage_line = (*g_stage)[y];
+        g_stage_pixel = &g_stage_pixels[y * WIDTH];
+        for (i = 0; i < LINE_WORDS; ++i) {
+            g_stage_keep[i] = (line_t)~0;
+        }
+        for (i = x; i < x + w; ++i) {
+            g_stage_keep[i / DRIVER_PIXELS] &= ~(((1 << CHANNELS) - 1) <<
+                    (i % DRIVER_PIXELS * CHANNELS));
+        }
+        g_rect_width = w;
+        g_rect_column = 0;
+        g_rect_pixels = w * h;
         return;
     }
-    g_frame_csel = &g_program_csel[LINES];
-
-    if (g_switch_buffer) {
-        size_t next_index;
-        g_switch_buffer = false;
-        next_index = ROUND_BUFFER_INDEX(g_frame_index + 1);
-        g_frame_index = next_index;
-        g_frame = &g_buffers[next_index];
+    if (!g_rect_pixels) {
+        return;
+    }
+    // Pad each row of the rectangle to a whole line; the padding falls in
+    //  kept channels and is discarded, and repeats the pixels staged there
+    //  so that g_stage_pixels keeps them too
+    if (!g_rect_column) {
+        for (i = g_rect_x; i > 0; --i) {
+            SetFrameData(*g_stage_pixel);
+        }
+    }
+    SetFrameData(data);
+    if (++g_rect_column == g_rect_width) {
+        for (i = WIDTH - g_rect_x - g_rect_width; i > 0; --i) {
+            SetFrameData(*g_stage_pixel);
+        }
+        g_rect_column = 0;
+    }
+    if (!(--g_rect_pixels)) {
+        EndRect();
     }
-    g_frame_line = (*g_frame)[LINES];
 }
 
-void
-SSP1_IRQHandler(void)
+static void
+SetPackedData(uintptr_t data, uintptr_t offset)
 {
-    uintptr_t data = (HOST_DATA)LPC_SSP1->DR;
-    enum HOST_COMMAND cmd = g_command;
-    uintptr_t length = g_command_length;
-
-    if (!length) {
-        g_command = cmd = (enum HOST_COMMAND) data;
-        if ((cmd & HOST_COMMAND_LENGTH_MASK) == HOST_COMMAND_VARIABLE) {
-            g_command_length = COMMAND_LENGTH_VARIABLE;
+    intptr_t i;
+    if (!offset) {
+        g_packed_format = data >> 8;
+        g_packed_colors = data & 0xff;
+        return;
+    }
+    if (offset <= g_packed_colors) {
+        if (offset <= HOST_PACKED_COLORS) {
+            g_packed_palette[offset - 1] = (pixel_t)data;
+        }
+        return;
+    }
+    switch (g_packed_format) {
+    case HOST_PACKED_INDEX2:
+        for (i = 16 / 2; i > 0; --i) {
+            SetFrameData(g_packed_palette[data & 0x3]);
+            data >>= 2;
+        }
+        break;
+    case HOST_PACKED_INDEX4:
+        for (i = 16 / 4; i > 0; --i) {
+            SetFrameData(g_packed_palette[data & 0xf]);
+            data >>= 4;
+        }
+        break;
+    case HOST_PACKED_RUN:
+        for (i = data >> 8; i > 0; --i) {
+            SetFrameData(g_packed_palette[data & 0xf]);
+        }
+        break;
+    }
+}
+
+static void
+NextFrame(void)
+{
+    CYCLES_BEGIN();
+    size_t ready = g_frame_ready;
+    size_t frame = g_frame_index;
+    // A frame staged again for dithering is replaced without a drop
+    bool waiting = ready != frame && !g_ready_refresh;
+    pixel_t *pixels = g_ready_pixels;
+    g_stage_fresh = true;
+    if (waiting && g_flip_policy == HOST_FLIP_QUEUE) {
+        // Stage the next frame over this one
+        ++g_flip_dropped;
+        g_stage_dither = g_next_dither;
+        EndRect();
+        CYCLES_END(HOST_CYCLES_NEXT_FRAME);
+        return;
+    }
+    // The timer only switches to g_frame_ready, so once it is replaced
+    //  the buffer shown is either frame as read below, or the staged frame
+    SetScan(g_stage_index);
+    g_scan_refresh[g_stage_index] = g_stage_dither && !g_stage_planes;
+    g_ready_refresh = false;
+    g_frame_ready = g_stage_index;
+    frame = g_frame_index;
+    if (waiting && frame != ready) {
+        ++g_flip_dropped;
+    }
+    do {
+        g_stage_index = ROUND_BUFFER_INDEX(g_stage_index + 1);
+    } while (g_stage_index == frame || g_stage_index == g_frame_ready);
+    g_stage = &g_buffers[g_stage_index];
+    g_ready_pixels = g_stage_pixels;
+    g_ready_planes = g_stage_planes;
+    g_stage_pixels = pixels;
+    g_stage_planes = false;
+    g_stage_dither = g_next_dither;
+    EndRect();
+    if (g_program_profile[g_stage_index] != g_stage_profile) {
+        SetProgram(g_stage_index);
+    }
+    CYCLES_END(HOST_CYCLES_NEXT_FRAME);
+}
+
+static void
+SetProfile(uintptr_t profile)
+{
+    if (profile >= PROFILES) {
+        profile = PROFILES - 1;
+    }
+    if (profile == g_stage_profile) {
+        return;
+    }
+    // Restart the staged frame with the new profile;
+    //  frames already flipped are shown with their own profile
+    g_stage_profile = profile;
+    SetProgram(g_stage_index);
+    g_stage_fresh = true;
+    EndRect();
+}
+
+ALWAYS_INLINE
+static void
+StartFrame(size_t next_index)
+{
+    // Switch to buffer next_index, with CSEL already on its first line
+    if (next_index != g_frame_index) {
+        g_frame_index = next_index;
+#ifdef HOST_MISO
+        ++g_frame_shown;
+#endif
+        g_frame_program = g_program_interval[next_index];
+        g_frame_interval = g_frame_interval_end =
+                &g_frame_program[g_program_length[next_index]];
+        g_frame_schedule = g_frame_step = g_program_schedule[next_index];
+        SetFrameBrightness();
+    }
+    g_frame_csel = &g_scan_csel[next_index][g_scan_length[next_index]];
+    g_frame_scan = &g_scan_line[next_index][g_scan_length[next_index]];
+    g_frame_line = *g_frame_scan;
+    LoadFrameEntry();
+}
+
+static void
+StopDriver(void)
+{
+    // Latch the first entry of the frame, which is dark for a dark frame;
+    //  gating SSP0 now could leave its words in the FIFO, so the timer
+    //  gates the clocks once they are out instead
+    SendFrameEntry();
+    g_driver_idle = true;
+    StartDriverTimer();
+}
+
+ALWAYS_INLINE
+static size_t
+NextScanIndex(void)
+{
+    // Buffer of the next scan, which is the buffer shown while flips wait
+    //  for a later scan
+    if (g_flip_held) {
+        if ((g_scan_number - g_flip_scan) & 0x8000) {
+            return g_frame_index;
+        }
+        g_flip_held = false;
+    }
+    return g_frame_ready;
+}
+
+static void
+WakeDriver(void)
+{
+    // Show the last frame flipped while idle, from its start, without the
+    //  timer gating the clocks meanwhile
+    size_t next_index;
+    __disable_irq();
+    next_index = NextScanIndex();
+    if (!g_driver_idle) {
+        __enable_irq();
+        return;
+    }
+    LPC_SYSCON->SYSAHBCLKCTRL |= SYSAHBCLKCTRL_CT32B0 | SYSAHBCLKCTRL_SSP0;
+    if (next_index != g_frame_index) {
+        LPC_GPIO->NOT[CSEL0_PORT] = (uint32_t)(g_scan_enter[g_frame_index] ^
+                g_scan_enter[next_index]);
+        StartFrame(next_index);
+    }
+    // Scans are counted on while flips wait for one
+    if ((g_driver_blank || g_scan_dark[next_index]) && !g_flip_held) {
+        StopDriver();
+    } else {
+        g_driver_idle = false;
+        StartDriverTimer();
+    }
+    __enable_irq();
+}
+
+static void
+SyncScan(uintptr_t number)
+{
+    // Restart the scan from the first line of the frame shown, with the
+    //  timer at the start of its program
+    size_t index = g_frame_index;
+
+    __disable_irq();
+    LPC_SYSCON->SYSAHBCLKCTRL |= SYSAHBCLKCTRL_CT32B0 | SYSAHBCLKCTRL_SSP0;
+    LPC_GPIO->NOT[CSEL0_PORT] = (uint32_t)((LPC_GPIO->PIN[CSEL0_PORT] ^
+            PROGRAM_CSEL_LINE[0] ^ g_scan_enter[index]) & PROGRAM_CSEL(0, 7));
+    g_frame_interval = g_frame_interval_end;
+    g_frame_step = g_frame_schedule;
+    StartFrame(index);
+    g_scan_number = number;
+    g_driver_idle = false;
+    StartDriverTimer();
+    __enable_irq();
+}
+
+ALWAYS_INLINE
+static void
+StartDimTimer(uintptr_t interval)
+{
+    // Blank the drivers for the start of the interval and light them for
+    //  its last part, which comes after the words sent are latched; the
+    //  next interval blanks them again
+    uintptr_t length = (interval + 1) * g_driver_tick;
+    uintptr_t on;
+
+    LPC_GPIO->SET[BLANK_PORT] = 1 << BLANK_PIN;
+    // A match left from the last interval would light this one early
+    LPC_CT16B0->IR = CT32B0_IR_MR0INT;
+    NVIC_ClearPendingIRQ(TIMER_16_0_IRQn);
+    if (g_driver_blank || length < g_driver_latch + DIM_TIMER_LATENCY) {
+        return;
+    }
+    on = (length * g_frame_brightness) >> HOST_BRIGHTNESS_SHIFT;
+    if (on > length - g_driver_latch) {
+        on = length - g_driver_latch;
+    }
+    if (on < DIM_TIMER_LATENCY) {
+        return;
+    }
+    LPC_CT16B0->TC = 0;
+    LPC_CT16B0->MR0 = (uint32_t)(length - on);
+    LPC_CT16B0->TCR = CT32B0_TCR(CT32B0_CEN_ENABLED, CT32B0_CRST_NORMAL);
+}
+
+ALWAYS_INLINE
+static void
+DriverTimerInterrupt(void)
+{
+    intptr_t i;
+    uintptr_t csel;
+    size_t next_index;
+
+    if (g_driver_idle) {
+        // Gate the clocks once the entry latched by StopDriver has shifted
+        //  out, or check again at the next match
+        LPC_CT32B0->IR = CT32B0_IR_MR0INT;
+        if (!(LPC_SSP0->SR & SSP_SR_BSY)) {
+            LPC_CT32B0->TCR = CT32B0_TCR(CT32B0_CEN_DISABLED,
+                    CT32B0_CRST_NORMAL);
+            LPC_SYSCON->SYSAHBCLKCTRL &= ~(SYSAHBCLKCTRL_CT32B0 |
+                    SYSAHBCLKCTRL_SSP0);
+        }
+        return;
+    }
+    SendFrameEntry();
+    LPC_CT32B0->IR = CT32B0_IR_MR0INT;
+#ifdef CYCLE_STATS
+    // The match resets TC to 0 on the tick after it, so TC has only moved
+    //  on from 0 if the interrupt was taken late
+    if (LPC_CT32B0->TC && LPC_CT32B0->TC < LPC_CT32B0->MR0) {
+        ++g_cycle_timer_late;
+    }
+#endif
+    LPC_CT32B0->TC = (uintptr_t)(-1);
+    LPC_CT32B0->MR0 = (uint32_t)(*(--g_frame_interval));
+    if (g_frame_brightness != HOST_BRIGHTNESS_FULL) {
+        StartDimTimer(*g_frame_interval);
+    }
+
+    if (g_frame_interval != g_frame_program) {
+        // Switch the channels of the next step to their next plane
+        uintptr_t step = *(g_frame_step++);
+        uintptr_t mask = (line_t)step;
+        const line_t *plane = &g_frame_line[step >> 16];
+        for (i = LINE_WORDS - 1; i >= 0; --i) {
+            g_frame_entry[i] = (g_frame_entry[i] & ~mask) | (plane[i] & mask);
+        }
+        return;
+    }
+    g_frame_interval = g_frame_interval_end;
+    g_frame_step = g_frame_schedule;
+
+#if !(CSEL0_PORT == CSEL1_PORT && CSEL1_PORT == CSEL2_PORT)
+#error CSEL pins must be in same port
+#endif
+    csel = *(--g_frame_csel);
+    g_frame_line = *(--g_frame_scan);
+    if (g_frame_line) {
+        LPC_GPIO->NOT[CSEL0_PORT] = (uint32_t)csel;
+        LoadFrameEntry();
+        return;
+    }
+
+    ++g_scan_number;
+    next_index = NextScanIndex();
+    LPC_GPIO->NOT[CSEL0_PORT] =
+            (uint32_t)(csel ^ g_scan_enter[next_index]);
+    StartFrame(next_index);
+    if (g_scan_refresh[next_index]) {
+        // Dither the next scan, see RenderDither
+        SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    }
+    if ((g_driver_blank || g_scan_dark[next_index]) && !g_flip_held) {
+        StopDriver();
+    }
+}
+
+void
+TIMER32_0_IRQHandler(void)
+{
+    CYCLES_BEGIN();
+    DriverTimerInterrupt();
+    CYCLES_END(HOST_CYCLES_DRIVER_TIMER);
+}
+
+void
+TIMER16_0_IRQHandler(void)
+{
+    // Light the drivers for the rest of the interval, see StartDimTimer
+    LPC_CT16B0->IR = CT32B0_IR_MR0INT;
+    if (!g_driver_blank) {
+        LPC_GPIO->CLR[BLANK_PORT] = 1 << BLANK_PIN;
+    }
+}
+
+ALWAYS_INLINE
+static void
+HostInterrupt(void)
+{
+    // Only queue the words here, so that SSP1 is never kept waiting for
+    //  pixels to be staged; RXIM comes with the FIFO half full and RTIM
+    //  with any words left after it, and both are cleared by the reads
+    uintptr_t head = g_host_ring_head;
+    uintptr_t tail = g_host_ring_tail;
+#ifdef HOST_MISO
+    uintptr_t received = 0;
+#endif
+
+    while (LPC_SSP1->SR & SSP_SR_RNE) {
+        uintptr_t data = (HOST_DATA)LPC_SSP1->DR;
+        uintptr_t waiting = head - tail;
+#ifdef HOST_MISO
+        ++received;
+#endif
+        if (waiting == HOST_RING_SIZE) {
+#ifdef HOST_MISO
+            ++g_host_overruns;
+#endif
+            continue;
+        }
+        g_host_ring[head & (HOST_RING_SIZE - 1)] = (HOST_DATA)data;
+        ++head;
+        if (waiting >= g_host_ring_high) {
+            g_host_ring_high = waiting + 1;
+        }
+    }
+#ifdef HOST_MISO
+    if (LPC_SSP1->RIS & SSP_IMSC_RORIM) {
+        LPC_SSP1->ICR = SSP_IMSC_RORIM;
+        ++g_host_overruns;
+    }
+    // Each word received clocked out one status word
+    if (g_status_words) {
+        if (received < g_status_words) {
+            g_status_words -= received;
+        } else {
+            g_status_words = 0;
+            SetStatusOutput(SSP_SOD_OUTPUT_DISABLED);
+        }
+    }
+#endif
+    if (head != g_host_ring_head) {
+        g_host_ring_head = head;
+        SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    }
+}
+
+void
+SSP1_IRQHandler(void)
+{
+    CYCLES_BEGIN();
+    HostInterrupt();
+    CYCLES_END(HOST_CYCLES_HOST_SSP);
+}
+
+static void
+InitRenderTimer(void)
+{
+    // CT32B1 is only clocked while it counts frames, see SetRenderTimer
+    NVIC_SetPriority(TIMER_32_1_IRQn, NVIC_PRIO_RENDER_TIMER);
+    NVIC_ClearPendingIRQ(TIMER_32_1_IRQn);
+    NVIC_EnableIRQ(TIMER_32_1_IRQn);
+    g_render_timer = false;
+    g_widget_animated = false;
+}
+
+static void
+SetRenderTimer(void)
+{
+    // Count frames at HOST_RENDER_RATE while a segment has an effect or a
+    //  fade of frames or brightness runs; CT32B1 has the same registers as
+    //  CT32B0
+    bool run = g_widget_animated || g_fade_active || g_brightness_active;
+    if (run == g_render_timer) {
+        return;
+    }
+    g_render_timer = run;
+    if (!run) {
+        LPC_CT32B1->TCR = CT32B0_TCR(CT32B0_CEN_DISABLED, CT32B0_CRST_NORMAL);
+        LPC_SYSCON->SYSAHBCLKCTRL &= ~SYSAHBCLKCTRL_CT32B1;
+        return;
+    }
+    LPC_SYSCON->SYSAHBCLKCTRL |= SYSAHBCLKCTRL_CT32B1;
+    LPC_CT32B1->IR = CT32B0_IR_MR0INT;
+    LPC_CT32B1->PR = 0;
+    LPC_CT32B1->MR0 = SystemCoreClock / HOST_RENDER_RATE - 1;
+    LPC_CT32B1->MCR = CT32B0_MCR_MR0I | CT32B0_MCR_MR0R;
+    LPC_CT32B1->TCR = CT32B0_TCR(CT32B0_CEN_ENABLED, CT32B0_CRST_RESET);
+    LPC_CT32B1->TCR = CT32B0_TCR(CT32B0_CEN_ENABLED, CT32B0_CRST_NORMAL);
+}
+
+static void
+FadeBrightness(uintptr_t level)
+{
+    // Set the brightness at once, or start to fade to it from the
+    //  brightness shown, which is a step of the fade running if there is one
+    if (level > HOST_BRIGHTNESS_FULL) {
+        level = HOST_BRIGHTNESS_FULL;
+    }
+    if (!g_brightness_frames) {
+        g_brightness_active = false;
+        SetRenderTimer();
+        SetDriverBrightness(level);
+        return;
+    }
+    g_brightness_from = g_driver_brightness;
+    g_brightness_to = level;
+    g_brightness_length = g_brightness_frames;
+    g_brightness_start = g_render_frame;
+    g_brightness_active = true;
+    SetRenderTimer();
+}
+
+static void
+StepBrightness(void)
+{
+    // Move the brightness along the fade; this runs from the render timer
+    //  rather than PendSV, so that fades keep going while the host sends
+    //  long commands
+    uintptr_t step = g_render_frame - g_brightness_start;
+    intptr_t delta = (intptr_t)g_brightness_to - (intptr_t)g_brightness_from;
+
+    if (step >= g_brightness_length) {
+        step = g_brightness_length;
+        g_brightness_active = false;
+        SetRenderTimer();
+    }
+    SetDriverBrightness((uintptr_t)((intptr_t)g_brightness_from +
+            delta * (intptr_t)step / (intptr_t)g_brightness_length));
+}
+
+void
+TIMER32_1_IRQHandler(void)
+{
+    // Render the next frame once the host words queued are parsed
+    LPC_CT32B1->IR = CT32B0_IR_MR0INT;
+    ++g_render_frame;
+    if (g_brightness_active) {
+        StepBrightness();
+    }
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+static void
+SetWidget(uintptr_t word, uintptr_t value)
+{
+    intptr_t i;
+    bool animated = false;
+    uintptr_t segment = word >> 8;
+    widget_segment_t *s;
+
+    if (segment >= HOST_WIDGET_SEGMENTS) {
+        return;
+    }
+    s = &g_widget_segments[segment];
+    switch (word & 0xff) {
+    case HOST_WIDGET_POSITION:
+        s->x = (uint8_t)(value >> 8);
+        s->y = (uint8_t)value;
+        break;
+    case HOST_WIDGET_SIZE:
+        s->width = (uint8_t)(value >> 8);
+        s->height = (uint8_t)value;
+        break;
+    case HOST_WIDGET_COLOR:
+        s->color = (pixel_t)value;
+        break;
+    case HOST_WIDGET_BACK:
+        s->back = (pixel_t)value;
+        break;
+    case HOST_WIDGET_FILL:
+        s->fill = (uint16_t)value;
+        break;
+    case HOST_WIDGET_EFFECT:
+        s->effect = (uint8_t)(value >> 8);
+        s->period = (uint8_t)value;
+        break;
+    default:
+        return;
+    }
+    s->drawn = s->width && s->height && s->x + s->width <= WIDTH &&
+            s->y + s->height <= LINES;
+    g_widget_changed = true;
+    for (i = 0; i < HOST_WIDGET_SEGMENTS; ++i) {
+        s = &g_widget_segments[i];
+        animated |= s->drawn && s->period && s->effect != HOST_WIDGET_STILL;
+    }
+    g_widget_animated = animated;
+    SetRenderTimer();
+}
+
+ALWAYS_INLINE
+static void
+DrawSegment(const widget_segment_t *s, uintptr_t frame, pixel_t *pixels)
+{
+    // One line of a segment, starting from its first pixel
+    uintptr_t i;
+    uintptr_t width = s->width;
+    uintptr_t period = s->period;
+    uintptr_t phase = period ? frame % period : 0;
+    // Filled width in 0x10000ths of a pixel, with 0xffff filling it all
+    uintptr_t filled = (s->fill + (s->fill >> 15)) * width;
+    uintptr_t full = filled >> 16;
+    uintptr_t edge = (filled >> 8) & 0xff;
+    uintptr_t weight = 0x100;
+    uintptr_t shift = 0;
+
+    switch (period ? s->effect : HOST_WIDGET_STILL) {
+    case HOST_WIDGET_PULSE:
+        phase = phase * 2 < period ? phase : period - phase;
+        weight = 0x100 - phase * 0x180 / period;
+        break;
+    case HOST_WIDGET_BLINK:
+        weight = phase * 2 < period ? 0x100 : 0;
+        break;
+    case HOST_WIDGET_MARQUEE:
+        shift = phase * width / period;
+        break;
+    }
+    for (i = 0; i < width; ++i) {
+        uintptr_t pos = i >= shift ? i - shift : i + width - shift;
+        pixel_t pixel = pos < full ? s->color : pos > full ? s->back :
+                BlendPixel(s->color, s->back, edge);
+        pixels[i] = weight == 0x100 ? pixel : BlendPixel(pixel, 0, weight);
+    }
+}
+
+static void
+RenderWidgets(void)
+{
+    // Draw the segments into the staged frame and flip it, if they changed
+    //  or a frame of their effects has passed, unless the host has started
+    //  to stage a frame, which is drawn over once it is flipped
+    CYCLES_BEGIN();
+    intptr_t i, x, y;
+    uintptr_t frame = g_render_frame;
+    pixel_t line[WIDTH];
+
+    if (!g_stage_fresh || (!g_widget_changed && (!g_widget_animated ||
+            frame == g_widget_rendered))) {
+        CYCLES_END(HOST_CYCLES_RENDER_WIDGETS);
+        return;
+    }
+    g_widget_changed = false;
+    g_widget_rendered = frame;
+    // Renders replace any fade of frames from the host
+    g_fade_active = false;
+    SetRenderTimer();
+    EndRect();
+    g_stage_fresh = false;
+    for (y = 0; y < LINES; ++y) {
+        for (x = 0; x < WIDTH; ++x) {
+            line[x] = 0;
+        }
+        for (i = 0; i < HOST_WIDGET_SEGMENTS; ++i) {
+            const widget_segment_t *s = &g_widget_segments[i];
+            if (s->drawn && y >= s->y && y < s->y + s->height) {
+                DrawSegment(s, frame, &line[s->x]);
+            }
+        }
+        for (x = 0; x < WIDTH; ++x) {
+            SetFrameData(line[x]);
+        }
+    }
+    NextFrame();
+    WakeDriver();
+    CYCLES_END(HOST_CYCLES_RENDER_WIDGETS);
+}
+
+static void
+FlipFrame(void)
+{
+    // Show the staged frame, or start to fade to it from the frame flipped
+    //  last, which is a frame of the fade running if there is one
+    intptr_t i;
+    if (!g_fade_frames || g_stage_planes || g_ready_planes) {
+        g_fade_active = false;
+        SetRenderTimer();
+        NextFrame();
+        WakeDriver();
+        return;
+    }
+    for (i = 0; i < LINES * WIDTH; ++i) {
+        g_fade_from[i] = g_ready_pixels[i];
+        g_fade_to[i] = g_stage_pixels[i];
+    }
+    // The staged frame is rendered over for each frame of the fade
+    g_stage_fresh = true;
+    EndRect();
+    g_fade_length = g_fade_frames;
+    g_fade_start = g_render_frame;
+    g_fade_step = 0;
+    g_fade_active = true;
+    SetRenderTimer();
+}
+
+static void
+RenderFade(void)
+{
+    // Stage and flip the next frame of the fade, unless the host has
+    //  started to stage a frame, which is faded to once it is flipped
+    CYCLES_BEGIN();
+    intptr_t i;
+    uintptr_t step = g_render_frame - g_fade_start;
+    uintptr_t weight;
+
+    if (!g_fade_active || !g_stage_fresh || step == g_fade_step) {
+        CYCLES_END(HOST_CYCLES_RENDER_FADE);
+        return;
+    }
+    if (step > g_fade_length) {
+        step = g_fade_length;
+    }
+    g_fade_step = step;
+    weight = step * 0x100 / g_fade_length;
+    EndRect();
+    g_stage_fresh = false;
+    for (i = 0; i < LINES * WIDTH; ++i) {
+        SetFrameData(BlendPixel(g_fade_to[i], g_fade_from[i], weight));
+    }
+    if (step == g_fade_length) {
+        g_fade_active = false;
+        SetRenderTimer();
+    }
+    NextFrame();
+    WakeDriver();
+    CYCLES_END(HOST_CYCLES_RENDER_FADE);
+}
+
+static void
+RenderDither(void)
+{
+    // Once a dithered frame is shown, stage it again with the errors left
+    //  by this scan and flip it for the next scan, unless the host has
+    //  started to stage a frame
+    CYCLES_BEGIN();
+    intptr_t i;
+    size_t index = g_frame_ready;
+
+    if (index != g_frame_index || !g_scan_refresh[index] ||
+            !g_stage_fresh) {
+        CYCLES_END(HOST_CYCLES_RENDER_DITHER);
+        return;
+    }
+    EndRect();
+    g_stage_fresh = false;
+    for (i = 0; i < LINES * WIDTH; ++i) {
+        SetFrameData(g_ready_pixels[i]);
+    }
+    NextFrame();
+    g_ready_refresh = true;
+    CYCLES_END(HOST_CYCLES_RENDER_DITHER);
+}
+
+ALWAYS_INLINE
+static void
+SetSetting(uintptr_t setting, uintptr_t value)
+{
+    switch (setting) {
+    case HOST_SET_PROFILE:
+        SetProfile(value);
+        break;
+    case HOST_SET_FLIP:
+        g_flip_policy = value;
+        break;
+    case HOST_SET_SCAN:
+        g_stage_scan = value;
+        break;
+    case HOST_SET_FADE:
+        g_fade_frames = value;
+        break;
+    case HOST_SET_DITHER:
+        // A frame partly staged keeps the levels it was started with
+        g_next_dither = value < DITHER_BITS ? value : DITHER_BITS;
+        if (g_stage_fresh) {
+            g_stage_dither = g_next_dither;
+        }
+        break;
+    case HOST_SET_TABLE:
+        g_table_cursor = value;
+        break;
+    case HOST_SET_BRIGHTNESS:
+        FadeBrightness(value);
+        break;
+    case HOST_SET_BRIGHTNESS_FADE:
+        g_brightness_frames = value;
+        break;
+    case HOST_SET_SYNC:
+        SyncScan(value);
+        break;
+    case HOST_SET_FLIP_AT:
+        g_flip_scan = value;
+        g_flip_held = true;
+        WakeDriver();
+        break;
+#ifdef HOST_MISO
+    case HOST_SET_STATUS:
+        g_status_page = value;
+        break;
+#endif
+    }
+}
+
+static void
+ParseHostData(uintptr_t data)
+{
+    enum HOST_COMMAND cmd = g_command;
+    uintptr_t length = g_command_length;
+
+    if (g_command_skip) {
+        --g_command_skip;
+        g_command_length = length - 1;
+        return;
+    }
+    if (!length) {
+        g_command = cmd = (enum HOST_COMMAND) data;
+        if ((cmd & HOST_COMMAND_LENGTH_MASK) == HOST_COMMAND_VARIABLE) {
+            g_command_length = COMMAND_LENGTH_VARIABLE;
             return;
         } else {
-            g_command_length = (((uintptr_t)cmd) >> HOST_COMMAND_LENGTH_SHIFT);
+            g_command_size = g_command_length =
+                    (((uintptr_t)cmd) >> HOST_COMMAND_LENGTH_SHIFT);
             if (g_command_length) {
                 return;
             }
         }
     } else if (length == COMMAND_LENGTH_VARIABLE) {
-        g_command_length = (uintptr_t) data;
+        g_command_size = g_command_length = (uintptr_t) data;
+        if (cmd == (HOST_FRAME | HOST_ID_BROADCAST)) {
+            // Skip to the slice for this board
+            g_command_skip = data < g_broadcast_start ?
+                    data : g_broadcast_start;
+        }
         return;
     } else {
         g_command_length = length -= 1;
     }
     if ((cmd & HOST_ID_MASK) && g_command_id &&
-            (cmd & HOST_ID_MASK) != g_command_id) {
+            (cmd & HOST_ID_MASK) != g_command_id &&
+            (cmd & HOST_ID_MASK) != HOST_ID_BROADCAST) {
         return;
     }
-    switch (cmd) {
+    switch (cmd & HOST_COMMAND_MASK) {
     case HOST_NOP:
         break;
     case HOST_ID:
+        if ((cmd & HOST_ID_MASK) == HOST_ID_BROADCAST) {
+            break;
+        }
         g_command_id = cmd & HOST_ID_MASK;
         setGPIO(SPI_EN_PORT, SPI_EN_PIN, !g_command_id);
+        SetBroadcastSlice();
         break;
     case HOST_FLIP:
-        NextFrame();
+        FlipFrame();
+        break;
+    case HOST_STATUS:
+#ifdef HOST_MISO
+        if ((cmd & HOST_ID_MASK) == g_command_id && !g_status_words) {
+            SendStatus();
+        }
+#endif
         break;
     case HOST_BLANK:
         setGPIO(BLANK_PORT, BLANK_PIN, !!data);
+        g_driver_blank = !!data;
+        WakeDriver();
         break;
     case HOST_IREF:
         SetDriverIRef(data);
         break;
+    case HOST_SET:
+        if (length) {
+            g_command_setting = data;
+        } else {
+            SetSetting(g_command_setting, data);
+        }
+        break;
+    case HOST_WIDGET:
+        if (length) {
+            g_widget_field = data;
+        } else {
+            SetWidget(g_widget_field, data);
+        }
+        break;
     case HOST_FILL:
+        g_stage_fresh = false;
         FillFrame(data);
         break;
+    case HOST_TABLE:
+        SetTableData(data);
+        break;
     case HOST_FRAME:
+        g_stage_fresh = false;
         SetFrameData(data);
+        if (cmd == (HOST_FRAME | HOST_ID_BROADCAST) &&
+                g_command_size - length == g_broadcast_end) {
+            // Skip the slices for boards after this one
+            g_command_skip = length;
+        }
+        break;
+    case HOST_RECT:
+        SetRectData(data, g_command_size - length - 1);
         break;
+    case HOST_PACKED:
+        g_stage_fresh = false;
+        SetPackedData(data, g_command_size - length - 1);
+        break;
+    case HOST_PLANES:
+        g_stage_fresh = false;
+        SetPlaneData(data, g_command_size - length - 1);
+        break;
+    }
+}
+
+#ifdef HOST_FRAMED
+// CRC of host frames, four bits at a time
+#define CRC_BIT(crc) \
+    ((((crc) << 1) ^ ((crc) & 0x8000 ? HOST_CRC_POLY : 0)) & HOST_DATA_MASK)
+#define CRC_NIBBLE(n)   CRC_BIT(CRC_BIT(CRC_BIT(CRC_BIT((n) << 12))))
+
+static const uint16_t CRC_TABLE[16] = {
+    CRC_NIBBLE(0x0), CRC_NIBBLE(0x1), CRC_NIBBLE(0x2), CRC_NIBBLE(0x3),
+    CRC_NIBBLE(0x4), CRC_NIBBLE(0x5), CRC_NIBBLE(0x6), CRC_NIBBLE(0x7),
+    CRC_NIBBLE(0x8), CRC_NIBBLE(0x9), CRC_NIBBLE(0xa), CRC_NIBBLE(0xb),
+    CRC_NIBBLE(0xc), CRC_NIBBLE(0xd), CRC_NIBBLE(0xe), CRC_NIBBLE(0xf)
+};
+
+ALWAYS_INLINE
+static uintptr_t
+UpdateCrc(uintptr_t crc, uintptr_t data)
+{
+    intptr_t i;
+    crc ^= data;
+    for (i = 0; i < 4; ++i) {
+        crc = ((crc << 4) & HOST_DATA_MASK) ^ CRC_TABLE[crc >> 12];
+    }
+    return crc;
+}
+
+static void
+DropCommand(void)
+{
+    // Staging of a cut short command starts over with the next one
+    if (g_command_length || g_command_skip) {
+        g_command_length = 0;
+        g_command_skip = 0;
+        EndRect();
+    }
+}
+
+static void
+ParseHostFrames(void)
+{
+    // Frames stay in the ring until they have arrived whole and their CRC
+    //  matches; after a bad one, the sync is looked for from the next word
+    uintptr_t tail = g_host_ring_tail;
+    uintptr_t header, length, crc, end, i;
+
+    while (tail != g_host_ring_head) {
+        if (g_host_ring[tail & (HOST_RING_SIZE - 1)] != HOST_FRAMED_SYNC) {
+            g_host_ring_tail = ++tail;
+            continue;
+        }
+        if (g_host_ring_head - tail < 2) {
+            break;
+        }
+        header = g_host_ring[(tail + 1) & (HOST_RING_SIZE - 1)];
+        length = header & ~HOST_FRAMED_CONTINUE;
+        end = tail + 2 + length;    // CRC word
+        if (length <= HOST_FRAMED_WORDS) {
+            if (g_host_ring_head - tail <= 2 + length) {
+                break;
+            }
+            crc = UpdateCrc(HOST_CRC_INIT, header);
+            for (i = tail + 2; i != end; ++i) {
+                crc = UpdateCrc(crc, g_host_ring[i & (HOST_RING_SIZE - 1)]);
+            }
+            if (crc == g_host_ring[end & (HOST_RING_SIZE - 1)]) {
+                if (!(header & HOST_FRAMED_CONTINUE)) {
+                    DropCommand();
+                    g_framed_lost = false;
+                }
+                // Free each word once parsed, as payloads take a while
+                for (tail += 2; tail != end && !g_framed_lost; ) {
+                    ParseHostData(g_host_ring[tail & (HOST_RING_SIZE - 1)]);
+                    g_host_ring_tail = ++tail;
+                }
+                g_host_ring_tail = tail = end + 1;
+                continue;
+            }
+        }
+#ifdef HOST_MISO
+        ++g_host_bad_frames;
+#endif
+        g_framed_lost = true;
+        DropCommand();
+        g_host_ring_tail = ++tail;
+    }
+}
+#endif
+
+void
+PendSV_Handler(void)
+{
+    // Parse the words queued by SSP1, including any queued meanwhile
+    CYCLES_BEGIN();
+#ifdef HOST_FRAMED
+    ParseHostFrames();
+#else
+    uintptr_t tail = g_host_ring_tail;
+    while (tail != g_host_ring_head) {
+        ParseHostData(g_host_ring[tail & (HOST_RING_SIZE - 1)]);
+        g_host_ring_tail = ++tail;
     }
+#endif
+    // Frames are rendered between commands only
+    if (!g_command_length) {
+        RenderWidgets();
+        RenderFade();
+        RenderDither();
+    }
+    CYCLES_END(HOST_CYCLES_HOST_PARSE);
 }
 
 int
@@ -500,20 +2017,26 @@ main(void)
 
     __disable_irq();
     SCB->SCR |= SCB_SCR_SLEEPONEXIT_Msk;
+#ifdef CYCLE_STATS
+    InitCycles();
+#endif
     InitFrame();
-    InitSource();
     InitProgram();
+    InitTables();
+    InitSource();
     InitHostSPI();
     InitHostCommand();
     InitDriverSPI();
     InitDriverTimer();
+    InitDimTimer();
     InitDriverSignals();
+    InitRenderTimer();
 
 #ifndef DEMO
     __enable_irq();
 #else
     setGPIO(BLANK_PORT, BLANK_PIN, GPIO_LO);
-    g_frame_csel = &g_program_csel[LINES];
+    g_frame_csel = &PROGRAM_CSEL[LINES];
 #endif
 
     while (true) {
@@ -525,8 +2048,8 @@ main(void)
         DELAY;
         LPC_SSP0->DR = data; //rand() & 0x0000FFFF;
         LPC_GPIO->NOT[CSEL0_PORT] = (uint32_t)*(--g_frame_csel);
-        if (g_frame_csel == g_program_csel) {
-            g_frame_csel = &g_program_csel[LINES];
+        if (g_frame_csel == PROGRAM_CSEL) {
+            g_frame_csel = &PROGRAM_CSEL[LINES];
         }
         if (LPC_SSP1->MIS & (SSP_IMSC_RTIM | SSP_IMSC_RXIM)) {
             data = LPC_SSP1->DR;
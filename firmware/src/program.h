@@ -0,0 +1,163 @@
+/*
+ * program.h
+ *
+ * Timer programs for each bit depth, built at compile time so that they
+ * live in flash. See SimCheckPrograms in sim/sim.c for the loops these
+ * tables are checked against.
+ */
+
+#ifndef PROGRAM_H_
+#define PROGRAM_H_
+
+typedef uint16_t    program_interval_t;
+// Format: 0xPPPPCCCC
+//  where C are the channels to switch and P is the plane to switch them to
+typedef uint32_t    program_step_t;
+
+#if BITS != 9 || DRIVER_CHANNELS != 16
+#error Change program tables below
+#endif
+
+/*
+ * A program for bits planes has a rising half and a falling half. Entry
+ * (i, j) of the rising half switches channels showing plane j to plane i,
+ * for i from 1 to bits - 1 and j from i - 1 down to 0. Entry (i, j) of the
+ * falling half switches channels showing plane i to plane j, for i from
+ * bits - 1 down to 1 and j from 0 to i - 1. The timer builds each entry
+ * from the previous one and the bit-planes of the line (see SetFrameData),
+ * so only the first entry of a line is stored. Every driver of a line runs
+ * the same program on its own word.
+ */
+#define PROGRAM_FALL_1(m, b) m(b, 1, 0)
+#define PROGRAM_FALL_2(m, b) m(b, 2, 1), m(b, 2, 0)
+#define PROGRAM_FALL_3(m, b) m(b, 3, 2), m(b, 3, 1), m(b, 3, 0)
+#define PROGRAM_FALL_4(m, b) m(b, 4, 3), m(b, 4, 2), m(b, 4, 1), m(b, 4, 0)
+#define PROGRAM_FALL_5(m, b) m(b, 5, 4), m(b, 5, 3), m(b, 5, 2), \
+    m(b, 5, 1), m(b, 5, 0)
+#define PROGRAM_FALL_6(m, b) m(b, 6, 5), m(b, 6, 4), m(b, 6, 3), \
+    m(b, 6, 2), m(b, 6, 1), m(b, 6, 0)
+#define PROGRAM_FALL_7(m, b) m(b, 7, 6), m(b, 7, 5), m(b, 7, 4), \
+    m(b, 7, 3), m(b, 7, 2), m(b, 7, 1), m(b, 7, 0)
+#define PROGRAM_FALL_8(m, b) m(b, 8, 7), m(b, 8, 6), m(b, 8, 5), \
+    m(b, 8, 4), m(b, 8, 3), m(b, 8, 2), m(b, 8, 1), m(b, 8, 0)
+
+#define PROGRAM_RISE_1(m, b) m(b, 1, 0)
+#define PROGRAM_RISE_2(m, b) m(b, 2, 0), m(b, 2, 1)
+#define PROGRAM_RISE_3(m, b) m(b, 3, 0), m(b, 3, 1), m(b, 3, 2)
+#define PROGRAM_RISE_4(m, b) m(b, 4, 0), m(b, 4, 1), m(b, 4, 2), m(b, 4, 3)
+#define PROGRAM_RISE_5(m, b) m(b, 5, 0), m(b, 5, 1), m(b, 5, 2), \
+    m(b, 5, 3), m(b, 5, 4)
+#define PROGRAM_RISE_6(m, b) m(b, 6, 0), m(b, 6, 1), m(b, 6, 2), \
+    m(b, 6, 3), m(b, 6, 4), m(b, 6, 5)
+#define PROGRAM_RISE_7(m, b) m(b, 7, 0), m(b, 7, 1), m(b, 7, 2), \
+    m(b, 7, 3), m(b, 7, 4), m(b, 7, 5), m(b, 7, 6)
+#define PROGRAM_RISE_8(m, b) m(b, 8, 0), m(b, 8, 1), m(b, 8, 2), \
+    m(b, 8, 3), m(b, 8, 4), m(b, 8, 5), m(b, 8, 6), m(b, 8, 7)
+
+// Rows 1 to b - 1 with j falling, and rows b - 1 to 1 with j rising
+#define PROGRAM_FALLS_2(m, b) PROGRAM_FALL_1(m, b)
+#define PROGRAM_FALLS_3(m, b) PROGRAM_FALLS_2(m, b), PROGRAM_FALL_2(m, b)
+#define PROGRAM_FALLS_4(m, b) PROGRAM_FALLS_3(m, b), PROGRAM_FALL_3(m, b)
+#define PROGRAM_FALLS_5(m, b) PROGRAM_FALLS_4(m, b), PROGRAM_FALL_4(m, b)
+#define PROGRAM_FALLS_6(m, b) PROGRAM_FALLS_5(m, b), PROGRAM_FALL_5(m, b)
+#define PROGRAM_FALLS_7(m, b) PROGRAM_FALLS_6(m, b), PROGRAM_FALL_6(m, b)
+#define PROGRAM_FALLS_8(m, b) PROGRAM_FALLS_7(m, b), PROGRAM_FALL_7(m, b)
+#define PROGRAM_FALLS_9(m, b) PROGRAM_FALLS_8(m, b), PROGRAM_FALL_8(m, b)
+
+#define PROGRAM_RISES_2(m, b) PROGRAM_RISE_1(m, b)
+#define PROGRAM_RISES_3(m, b) PROGRAM_RISE_2(m, b), PROGRAM_RISES_2(m, b)
+#define PROGRAM_RISES_4(m, b) PROGRAM_RISE_3(m, b), PROGRAM_RISES_3(m, b)
+#define PROGRAM_RISES_5(m, b) PROGRAM_RISE_4(m, b), PROGRAM_RISES_4(m, b)
+#define PROGRAM_RISES_6(m, b) PROGRAM_RISE_5(m, b), PROGRAM_RISES_5(m, b)
+#define PROGRAM_RISES_7(m, b) PROGRAM_RISE_6(m, b), PROGRAM_RISES_6(m, b)
+#define PROGRAM_RISES_8(m, b) PROGRAM_RISE_7(m, b), PROGRAM_RISES_7(m, b)
+#define PROGRAM_RISES_9(m, b) PROGRAM_RISE_8(m, b), PROGRAM_RISES_8(m, b)
+
+// Channels showing plane p, starting from plane 0 in the last channel of
+//  each driver
+#define PROGRAM_CHANNEL(b, p, n) \
+    ((15 - (p) - (n) * (b)) >= 0 ? (1 << (15 - (p) - (n) * (b))) : 0)
+#define PROGRAM_CHANNELS(b, p) (line_t)( \
+    PROGRAM_CHANNEL(b, p, 0) | PROGRAM_CHANNEL(b, p, 1) | \
+    PROGRAM_CHANNEL(b, p, 2) | PROGRAM_CHANNEL(b, p, 3) | \
+    PROGRAM_CHANNEL(b, p, 4) | PROGRAM_CHANNEL(b, p, 5) | \
+    PROGRAM_CHANNEL(b, p, 6) | PROGRAM_CHANNEL(b, p, 7))
+
+// Timer intervals are read from the end, so they are laid out in reverse;
+//  steps hold the offset of the plane in a staged line
+#define PROGRAM_RISE_INTERVAL(b, i, j) \
+    (program_interval_t)(((j) == 0 ? 1 : (1 << ((j) - 1))) * 2 - 1)
+#define PROGRAM_FALL_INTERVAL(b, i, j) \
+    (program_interval_t)(((j) + 1 == (i) ? 1 : (1 << (j))) * 2 - 1)
+#define PROGRAM_RISE_STEP(b, i, j) \
+    (PROGRAM_CHANNELS(b, j) | ((program_step_t)(i) * LINE_WORDS << 16))
+#define PROGRAM_FALL_STEP(b, i, j) \
+    (PROGRAM_CHANNELS(b, i) | ((program_step_t)(j) * LINE_WORDS << 16))
+
+// Planes of a pair shown by the first entry
+#define PROGRAM_FIRST_CHANNEL(b, w, pos) \
+    (((15 - (pos)) % (b)) / 2 == (w) ? \
+    ((plane_pair_t)1 << (pos)) << ((((15 - (pos)) % (b)) & 1) * 16) : 0)
+#define PROGRAM_FIRST(b, w) ( \
+    PROGRAM_FIRST_CHANNEL(b, w, 0) | PROGRAM_FIRST_CHANNEL(b, w, 1) | \
+    PROGRAM_FIRST_CHANNEL(b, w, 2) | PROGRAM_FIRST_CHANNEL(b, w, 3) | \
+    PROGRAM_FIRST_CHANNEL(b, w, 4) | PROGRAM_FIRST_CHANNEL(b, w, 5) | \
+    PROGRAM_FIRST_CHANNEL(b, w, 6) | PROGRAM_FIRST_CHANNEL(b, w, 7) | \
+    PROGRAM_FIRST_CHANNEL(b, w, 8) | PROGRAM_FIRST_CHANNEL(b, w, 9) | \
+    PROGRAM_FIRST_CHANNEL(b, w, 10) | PROGRAM_FIRST_CHANNEL(b, w, 11) | \
+    PROGRAM_FIRST_CHANNEL(b, w, 12) | PROGRAM_FIRST_CHANNEL(b, w, 13) | \
+    PROGRAM_FIRST_CHANNEL(b, w, 14) | PROGRAM_FIRST_CHANNEL(b, w, 15))
+
+#define PROGRAM_TABLES(b) \
+    static const program_interval_t PROGRAM_INTERVAL_ ## b[] = { \
+        PROGRAM_FALLS_ ## b(PROGRAM_FALL_INTERVAL, b), \
+        PROGRAM_RISES_ ## b(PROGRAM_RISE_INTERVAL, b), 1 }; \
+    static const program_step_t PROGRAM_SCHEDULE_ ## b[] = { \
+        PROGRAM_FALLS_ ## b(PROGRAM_RISE_STEP, b), \
+        PROGRAM_RISES_ ## b(PROGRAM_FALL_STEP, b) }; \
+    static const plane_pair_t PROGRAM_FIRST_ ## b[PLANE_PAIRS] = { \
+        PROGRAM_FIRST(b, 0), PROGRAM_FIRST(b, 1), PROGRAM_FIRST(b, 2), \
+        PROGRAM_FIRST(b, 3), PROGRAM_FIRST(b, 4) }
+
+PROGRAM_TABLES(2);
+PROGRAM_TABLES(3);
+PROGRAM_TABLES(4);
+PROGRAM_TABLES(5);
+PROGRAM_TABLES(6);
+PROGRAM_TABLES(7);
+PROGRAM_TABLES(8);
+PROGRAM_TABLES(9);
+
+// Tables for each bit depth from 2 to BITS
+static const program_interval_t *const PROGRAM_INTERVAL[BITS + 1] = {
+    NULL, NULL, PROGRAM_INTERVAL_2, PROGRAM_INTERVAL_3, PROGRAM_INTERVAL_4,
+    PROGRAM_INTERVAL_5, PROGRAM_INTERVAL_6, PROGRAM_INTERVAL_7,
+    PROGRAM_INTERVAL_8, PROGRAM_INTERVAL_9 };
+static const program_step_t *const PROGRAM_SCHEDULE[BITS + 1] = {
+    NULL, NULL, PROGRAM_SCHEDULE_2, PROGRAM_SCHEDULE_3, PROGRAM_SCHEDULE_4,
+    PROGRAM_SCHEDULE_5, PROGRAM_SCHEDULE_6, PROGRAM_SCHEDULE_7,
+    PROGRAM_SCHEDULE_8, PROGRAM_SCHEDULE_9 };
+static const plane_pair_t *const PROGRAM_FIRST[BITS + 1] = {
+    NULL, NULL, PROGRAM_FIRST_2, PROGRAM_FIRST_3, PROGRAM_FIRST_4,
+    PROGRAM_FIRST_5, PROGRAM_FIRST_6, PROGRAM_FIRST_7,
+    PROGRAM_FIRST_8, PROGRAM_FIRST_9 };
+
+// CSEL pins to toggle after each line of LINE_SEQUENCE
+#define PROGRAM_CSEL_PIN(x, n)  ((!!((x) & (1 << (n)))) << (CSEL ## n ## _PIN))
+#define PROGRAM_CSEL(from, to) \
+    (PROGRAM_CSEL_PIN((from) ^ (to), 0) | \
+     PROGRAM_CSEL_PIN((from) ^ (to), 1) | \
+     PROGRAM_CSEL_PIN((from) ^ (to), 2))
+
+#define PROGRAM_CSEL_NEXT(i) PROGRAM_CSEL(LINE_ROW(i), LINE_ROW((i) + 1))
+#define PROGRAM_CSEL_ROW(i) PROGRAM_CSEL(0, LINE_ROW(LINES - (i)))
+
+static const uintptr_t PROGRAM_CSEL[LINES] = {
+    MAKE_LINE_EACH(LINES, PROGRAM_CSEL_NEXT) };
+
+// CSEL pins selecting each line of a frame; lines are shown in reverse
+//  order of LINE_SEQUENCE, starting from its first
+static const uintptr_t PROGRAM_CSEL_LINE[LINES] = {
+    MAKE_LINE_EACH(LINES, PROGRAM_CSEL_ROW) };
+
+#endif /* PROGRAM_H_ */
@@ -0,0 +1,164 @@
+/*
+ * tbhb-stream.cpp
+ *
+ * Stream a moving gradient to a tbhb board and report the frame rate.
+ *
+ *   tbhb-stream -d /dev/spidev0.0         send to the board
+ *   tbhb-stream -t -n 3 | tbhb-sim -q     run on the simulator
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <unistd.h>
+
+#include "tbhb.h"
+
+namespace {
+
+void
+Usage(const char *name)
+{
+    std::fprintf(stderr,
+            "usage: %s [-d DEVICE | -o FILE] [-t] [-n FRAMES] [-w US] [-p]\n"
+            "          [-e BITS] [-f] [-g CHANNELSxWIDTHxLINES]\n"
+            "\n"
+            "  -d DEVICE  spidev device to send to\n"
+            "  -o FILE    file to write to (default stdout)\n"
+            "  -t         write text for tbhb-sim instead of binary\n"
+            "  -n FRAMES  frames to send (default 300)\n"
+            "  -w US      idle time after each flip (default 0)\n"
+            "  -p         flip only once the last frame is shown, as read\n"
+            "             back from the board (needs MISO)\n"
+            "  -e BITS    send frames as bit-planes encoded on the host, for\n"
+            "             a profile of BITS bit depth (9 by default)\n"
+            "  -f         send frames with a CRC, for boards built with\n"
+            "             HOST_FRAMED\n"
+            "  -g CHANNELSxWIDTHxLINES\n"
+            "             panel the board was built for (default 2x8x8)\n",
+            name);
+    std::exit(EXIT_FAILURE);
+}
+
+double
+Now()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+} // namespace
+
+int
+main(int argc, char **argv)
+{
+    const char *device = NULL;
+    const char *output = NULL;
+    tbhb::FileBackend::Format format = tbhb::FileBackend::BINARY;
+    unsigned long frames = 300;
+    unsigned wait_us = 0;
+    bool pace = false;
+    unsigned encode_bits = 0;
+    bool framed = false;
+    unsigned channels = 2, width = 8, lines = 8;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:o:tn:w:pe:fg:")) != -1) {
+        switch (opt) {
+        case 'd':
+            device = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 't':
+            format = tbhb::FileBackend::TEXT;
+            break;
+        case 'n':
+            frames = std::strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            wait_us = std::strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            pace = true;
+            break;
+        case 'e':
+            encode_bits = std::strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            framed = true;
+            break;
+        case 'g':
+            if (std::sscanf(optarg, "%ux%ux%u", &channels, &width,
+                    &lines) != 3) {
+                Usage(argv[0]);
+            }
+            break;
+        default:
+            Usage(argv[0]);
+        }
+    }
+    if (optind != argc || (device && output)) {
+        Usage(argv[0]);
+    }
+
+    try {
+        std::unique_ptr<tbhb::Backend> backend;
+        if (device) {
+            backend.reset(new tbhb::SpiDevBackend(device));
+        } else if (output) {
+            backend.reset(new tbhb::FileBackend(output, format));
+        } else {
+            backend.reset(new tbhb::FileBackend(stdout, format));
+        }
+        tbhb::Geometry geometry(channels, width, lines);
+        tbhb::Stream stream(*backend, geometry);
+        stream.Framed(framed);
+        std::vector<tbhb::pixel_t> pixels(geometry.FramePixels());
+        size_t line_words = geometry.lines * geometry.LineWords();
+        std::vector<HOST_DATA> planes(line_words * 16);
+
+        stream.Blank(HOST_BLANK_ON);
+        stream.Flush();
+        double start = Now();
+        for (unsigned long frame = 0; frame < frames; ++frame) {
+            for (size_t i = 0; i < pixels.size(); ++i) {
+                unsigned level = (i * 4 + frame * 2) & 0xff;
+                pixels[i] = geometry.Pixel(level, 0xff - level, level * 3);
+            }
+            if (encode_bits) {
+                tbhb::EncodePlanes(geometry, pixels.data(), pixels.size(),
+                        encode_bits, planes.data());
+                stream.Planes(planes.data(), line_words * encode_bits,
+                        encode_bits);
+            } else {
+                stream.Frame(pixels.data(), pixels.size());
+            }
+            if (pace) {
+                HOST_DATA status[HOST_STATUS_WORDS];
+                do {
+                    if (!stream.Status(status)) {
+                        throw std::runtime_error("no status from board");
+                    }
+                } while (status[HOST_STATUS_QUEUED]);
+            }
+            stream.Flip();
+            stream.Wait(wait_us);
+            stream.Flush();
+        }
+        double elapsed = Now() - start;
+        std::fprintf(stderr, "tbhb-stream: %lu frames in %.3f s (%.1f fps)\n",
+                frames, elapsed, elapsed > 0 ? frames / elapsed : 0.0);
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "tbhb-stream: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,525 @@
+/*
+ * tbhb.cpp
+ *
+ * See tbhb.h
+ */
+
+#include "tbhb.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace tbhb {
+
+namespace {
+
+// Default of the spidev bufsiz module parameter
+const size_t SPIDEV_BUFSIZ = 4096;
+// Transfers per message that fit in the ioctl size field
+const size_t SPIDEV_TRANSFERS =
+        ((1 << _IOC_SIZEBITS) - 1) / sizeof(spi_ioc_transfer);
+
+void
+ThrowErrno(const char *what)
+{
+    throw std::system_error(errno, std::system_category(), what);
+}
+
+size_t
+ReadBufsiz()
+{
+    size_t bufsiz = SPIDEV_BUFSIZ;
+    FILE *file = std::fopen("/sys/module/spidev/parameters/bufsiz", "r");
+    if (file) {
+        unsigned long value;
+        if (std::fscanf(file, "%lu", &value) == 1 && value) {
+            bufsiz = value;
+        }
+        std::fclose(file);
+    }
+    return bufsiz;
+}
+
+uint16_t
+UpdateCrc(uint16_t crc, HOST_DATA word)
+{
+    crc ^= word;
+    for (int i = 0; i < 16; ++i) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ HOST_CRC_POLY : crc << 1;
+    }
+    return crc;
+}
+
+// Bits of each channel of a pixel_t, as in firmware/src/defs.h
+const unsigned PIXEL_SHIFT[2][3] = { { 0, 8 }, { 0, 5, 11 } };
+const unsigned PIXEL_SIZE[2][3] = { { 8, 8 }, { 5, 6, 5 } };
+
+} // namespace
+
+Geometry::Geometry(unsigned channels, size_t width, size_t lines)
+    : channels(channels), width(width), lines(lines)
+{
+    // Same limits as the checks in firmware/src/defs.h
+    if ((channels != 2 && channels != 3) || !width || !lines ||
+            width % DriverPixels() || LineWords() > 8 || lines > 8) {
+        throw std::invalid_argument("panel geometry");
+    }
+}
+
+pixel_t
+Geometry::Pixel(unsigned red, unsigned green, unsigned blue) const
+{
+    const unsigned levels[3] = { red, green, blue };
+    pixel_t pixel = 0;
+    for (unsigned c = 0; c < channels; ++c) {
+        unsigned size = PIXEL_SIZE[channels - 2][c];
+        pixel |= static_cast<pixel_t>(
+                ((levels[c] & 0xff) >> (8 - size)) <<
+                PIXEL_SHIFT[channels - 2][c]);
+    }
+    return pixel;
+}
+
+unsigned
+Geometry::Level(pixel_t pixel, unsigned c) const
+{
+    unsigned size = PIXEL_SIZE[channels - 2][c];
+    unsigned value = (pixel >> PIXEL_SHIFT[channels - 2][c]) &
+            ((1 << size) - 1);
+    return (value << (8 - size)) | (value >> (2 * size - 8));
+}
+
+void
+EncodePlanes(const Geometry &geometry, const pixel_t *pixels, size_t count,
+        unsigned bits, HOST_DATA *planes)
+{
+    // Bit channels * x + c of a driver word is channel c of pixel x of the
+    //  driver, and each plane holds the driver words of a line in order
+    size_t driver_pixels = geometry.DriverPixels();
+    size_t words = geometry.LineWords();
+    if (count % geometry.width || bits < 1 || bits > 16) {
+        throw std::invalid_argument("not whole lines or bit depth");
+    }
+    for (size_t i = 0; i < count; i += geometry.width) {
+        std::fill(planes, planes + bits * words, 0);
+        for (size_t x = 0; x < geometry.width; ++x) {
+            HOST_DATA *word = planes + x / driver_pixels;
+            unsigned bit = x % driver_pixels * geometry.channels;
+            for (unsigned c = 0; c < geometry.channels; ++c, ++bit) {
+                unsigned level = HOST_GAMMA(geometry.Level(pixels[i + x], c),
+                        bits);
+                for (unsigned p = 0; p < bits; ++p) {
+                    word[p * words] |= static_cast<HOST_DATA>(
+                            ((level >> p) & 1) << bit);
+                }
+            }
+        }
+        planes += bits * words;
+    }
+}
+
+SpiDevBackend::SpiDevBackend(const std::string &path, uint32_t speed_hz)
+    : m_fd(-1), m_max_bytes(ReadBufsiz()), m_bytes(0)
+{
+    // SSP1 samples on the falling edge with SCLK idle low
+    uint8_t mode = SPI_MODE_1;
+    uint8_t bits = 8 * sizeof(HOST_DATA);
+
+    m_fd = open(path.c_str(), O_RDWR);
+    if (m_fd < 0) {
+        ThrowErrno(path.c_str());
+    }
+    if (ioctl(m_fd, SPI_IOC_WR_MODE, &mode) < 0 ||
+            ioctl(m_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+            ioctl(m_fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz) < 0) {
+        int error = errno;
+        close(m_fd);
+        errno = error;
+        ThrowErrno(path.c_str());
+    }
+    m_transfers.reserve(16);
+}
+
+SpiDevBackend::~SpiDevBackend()
+{
+    close(m_fd);
+}
+
+void
+SpiDevBackend::Submit()
+{
+    if (m_transfers.empty()) {
+        return;
+    }
+    unsigned long request = _IOC(_IOC_WRITE, SPI_IOC_MAGIC, 0,
+            m_transfers.size() * sizeof(spi_ioc_transfer));
+    if (ioctl(m_fd, request, m_transfers.data()) < 0) {
+        ThrowErrno("SPI_IOC_MESSAGE");
+    }
+    m_transfers.clear();
+    m_bytes = 0;
+}
+
+void
+SpiDevBackend::Transfer(const Segment *segments, size_t count)
+{
+    // One transfer per segment, unless a message would exceed the limits
+    //  of the driver; words of a segment are split at the byte limit
+    for (size_t i = 0; i < count; ++i) {
+        const HOST_DATA *words = segments[i].words;
+        size_t bytes = segments[i].count * sizeof(HOST_DATA);
+        do {
+            if (m_bytes >= m_max_bytes ||
+                    m_transfers.size() == SPIDEV_TRANSFERS) {
+                Submit();
+            }
+            size_t length = m_max_bytes - m_bytes;
+            length = (length < bytes ? length : bytes) &
+                    ~(sizeof(HOST_DATA) - 1);
+            spi_ioc_transfer transfer;
+            std::memset(&transfer, 0, sizeof(transfer));
+            transfer.tx_buf = reinterpret_cast<uintptr_t>(words);
+            transfer.len = length;
+            bytes -= length;
+            if (!bytes) {
+                transfer.delay_usecs = segments[i].delay_us;
+            }
+            m_transfers.push_back(transfer);
+            m_bytes += length;
+            words += length / sizeof(HOST_DATA);
+        } while (bytes);
+    }
+    Submit();
+}
+
+void
+SpiDevBackend::Receive(HOST_DATA *words, size_t count)
+{
+    // Zeros are shifted out without a transmit buffer
+    spi_ioc_transfer transfer;
+    std::memset(&transfer, 0, sizeof(transfer));
+    transfer.rx_buf = reinterpret_cast<uintptr_t>(words);
+    transfer.len = count * sizeof(HOST_DATA);
+    if (ioctl(m_fd, SPI_IOC_MESSAGE(1), &transfer) < 0) {
+        ThrowErrno("SPI_IOC_MESSAGE");
+    }
+}
+
+FileBackend::FileBackend(FILE *file, Format format)
+    : m_file(file), m_owned(false), m_format(format)
+{
+}
+
+FileBackend::FileBackend(const std::string &path, Format format)
+    : m_file(std::fopen(path.c_str(), format == BINARY ? "wb" : "w")),
+      m_owned(true), m_format(format)
+{
+    if (!m_file) {
+        ThrowErrno(path.c_str());
+    }
+}
+
+FileBackend::~FileBackend()
+{
+    if (m_owned) {
+        std::fclose(m_file);
+    }
+}
+
+void
+FileBackend::Transfer(const Segment *segments, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const Segment &segment = segments[i];
+        if (m_format == TEXT) {
+            for (size_t j = 0; j < segment.count; ++j) {
+                std::fprintf(m_file, j ? " %04x" : "%04x", segment.words[j]);
+            }
+            if (segment.count) {
+                std::fputc('\n', m_file);
+            }
+            if (segment.delay_us) {
+                std::fprintf(m_file, "wait %u\n", segment.delay_us);
+            }
+            continue;
+        }
+        // Little-endian words, as read by tbhb-sim -b
+        m_bytes.resize(segment.count * sizeof(HOST_DATA));
+        for (size_t j = 0; j < segment.count; ++j) {
+            m_bytes[j * 2] = static_cast<uint8_t>(segment.words[j]);
+            m_bytes[j * 2 + 1] = static_cast<uint8_t>(segment.words[j] >> 8);
+        }
+        if (std::fwrite(m_bytes.data(), 1, m_bytes.size(), m_file) !=
+                m_bytes.size()) {
+            ThrowErrno("fwrite");
+        }
+    }
+    if (std::fflush(m_file)) {
+        ThrowErrno("fflush");
+    }
+}
+
+void
+FileBackend::Receive(HOST_DATA *words, size_t count)
+{
+    // Keep the words clocked in, nothing can be read back
+    std::memset(words, 0, count * sizeof(HOST_DATA));
+    Segment segment = { words, count, 0 };
+    Transfer(&segment, 1);
+}
+
+Stream::Stream(Backend &backend, const Geometry &geometry, size_t capacity)
+    : m_backend(backend), m_geometry(geometry), m_target(HOST_ID_ALL),
+      m_framed(false)
+{
+    m_words.reserve(capacity);
+    m_segments.reserve(16);
+}
+
+void
+Stream::Command(enum HOST_COMMAND command)
+{
+    m_starts.push_back(m_words.size());
+    m_words.push_back(static_cast<HOST_DATA>(command | m_target));
+}
+
+void
+Stream::Variable(enum HOST_COMMAND command, size_t length)
+{
+    if (length > HOST_DATA_MASK) {
+        throw std::length_error("command too long");
+    }
+    Command(command);
+    m_words.push_back(static_cast<HOST_DATA>(length));
+}
+
+void
+Stream::Nop()
+{
+    Command(HOST_NOP);
+}
+
+void
+Stream::AssignId()
+{
+    Command(HOST_ID);
+}
+
+void
+Stream::Flip()
+{
+    Command(HOST_FLIP);
+}
+
+void
+Stream::Blank(enum HOST_COMMAND_BLANK blank)
+{
+    Command(HOST_BLANK);
+    m_words.push_back(static_cast<HOST_DATA>(blank));
+}
+
+void
+Stream::IRef(uintptr_t level)
+{
+    Command(HOST_IREF);
+    m_words.push_back(static_cast<HOST_DATA>(level));
+}
+
+void
+Stream::Fill(pixel_t pixel)
+{
+    Command(HOST_FILL);
+    m_words.push_back(pixel);
+}
+
+void
+Stream::Set(enum HOST_SETTING setting, uintptr_t value)
+{
+    Command(HOST_SET);
+    m_words.push_back(static_cast<HOST_DATA>(setting));
+    m_words.push_back(static_cast<HOST_DATA>(value));
+}
+
+void
+Stream::Widget(uintptr_t segment, enum HOST_WIDGET_FIELD field,
+        uintptr_t value)
+{
+    Command(HOST_WIDGET);
+    m_words.push_back(static_cast<HOST_DATA>(
+            HOST_WIDGET_WORD(segment, field)));
+    m_words.push_back(static_cast<HOST_DATA>(value));
+}
+
+void
+Stream::Table(enum HOST_TABLE_ID table, uintptr_t channel,
+        const uint16_t *values, size_t count)
+{
+    Set(HOST_SET_TABLE, HOST_TABLE_CURSOR(table, channel, 0));
+    for (size_t i = 0; i < count; ++i) {
+        Command(HOST_TABLE);
+        m_words.push_back(values[i]);
+    }
+}
+
+void
+Stream::Frame(const pixel_t *pixels, size_t count)
+{
+    Variable(HOST_FRAME, count);
+    m_words.insert(m_words.end(), pixels, pixels + count);
+}
+
+void
+Stream::Broadcast(const pixel_t *pixels, size_t boards)
+{
+    size_t count = boards * m_geometry.FramePixels();
+    if (count > HOST_DATA_MASK) {
+        throw std::length_error("command too long");
+    }
+    m_starts.push_back(m_words.size());
+    m_words.push_back(static_cast<HOST_DATA>(HOST_FRAME | HOST_ID_BROADCAST));
+    m_words.push_back(static_cast<HOST_DATA>(count));
+    m_words.insert(m_words.end(), pixels, pixels + count);
+}
+
+void
+Stream::Rect(uintptr_t x, uintptr_t y, uintptr_t width, uintptr_t height,
+        const pixel_t *pixels)
+{
+    Variable(HOST_RECT, 2 + width * height);
+    m_words.push_back(static_cast<HOST_DATA>(HOST_RECT_POSITION(x, y)));
+    m_words.push_back(static_cast<HOST_DATA>(HOST_RECT_SIZE(width, height)));
+    m_words.insert(m_words.end(), pixels, pixels + width * height);
+}
+
+void
+Stream::Packed(enum HOST_PACKED_FORMAT format, const pixel_t *palette,
+        size_t colors, const HOST_DATA *words, size_t count)
+{
+    if (colors > HOST_PACKED_COLORS) {
+        throw std::length_error("too many palette colors");
+    }
+    Variable(HOST_PACKED, 1 + colors + count);
+    m_words.push_back(static_cast<HOST_DATA>(
+            HOST_PACKED_HEADER(format, colors)));
+    m_words.insert(m_words.end(), palette, palette + colors);
+    m_words.insert(m_words.end(), words, words + count);
+}
+
+void
+Stream::Planes(const HOST_DATA *planes, size_t count, unsigned per_line)
+{
+    Variable(HOST_PLANES, 1 + count);
+    m_words.push_back(static_cast<HOST_DATA>(per_line));
+    m_words.insert(m_words.end(), planes, planes + count);
+}
+
+bool
+Stream::Status(HOST_DATA status[HOST_STATUS_WORDS])
+{
+    Command(HOST_STATUS);
+    Wait(HOST_STATUS_DELAY_US);
+    Flush();
+    m_backend.Receive(status, HOST_STATUS_WORDS);
+    return status[HOST_STATUS_VERSION] == HOST_VERSION;
+}
+
+bool
+Stream::Cycles(enum HOST_CYCLES_SECTION section,
+        HOST_DATA status[HOST_STATUS_WORDS])
+{
+    Set(HOST_SET_STATUS, HOST_STATUS_CYCLES | section);
+    bool answered = Status(status);
+    Set(HOST_SET_STATUS, HOST_STATUS_COUNTERS);
+    return answered;
+}
+
+void
+Stream::Wait(unsigned us)
+{
+    Segment segment = { NULL, m_words.size(), us };
+    m_segments.push_back(segment);
+}
+
+void
+Stream::Flush()
+{
+    // Segments hold end offsets until the buffer stops moving
+    size_t start = 0;
+    if (m_words.empty() && m_segments.empty()) {
+        return;
+    }
+    if (m_segments.empty() || m_segments.back().count != m_words.size()) {
+        Wait(0);
+    }
+    for (size_t i = 0; i < m_segments.size(); ++i) {
+        size_t end = m_segments[i].count;
+        m_segments[i].words = m_words.data() + start;
+        m_segments[i].count = end - start;
+        start = end;
+    }
+    if (m_framed) {
+        FrameSegments();
+    }
+    try {
+        m_backend.Transfer(m_segments.data(), m_segments.size());
+    } catch (...) {
+        m_words.clear();
+        m_segments.clear();
+        m_starts.clear();
+        throw;
+    }
+    m_words.clear();
+    m_segments.clear();
+    m_starts.clear();
+}
+
+void
+Stream::FrameSegments()
+{
+    // Frames never span a delay, and end before a command that would not
+    //  fit whole; segments hold counts until m_frames stops moving
+    m_frames.clear();
+    for (size_t i = 0; i < m_segments.size(); ++i) {
+        size_t start = m_segments[i].words - m_words.data();
+        size_t end = start + m_segments[i].count;
+        size_t first = m_frames.size();
+        while (start < end) {
+            size_t stop = std::min(end, start + HOST_FRAMED_WORDS);
+            std::vector<size_t>::const_iterator next =
+                    std::upper_bound(m_starts.begin(), m_starts.end(), stop);
+            if (stop < end && next != m_starts.begin() &&
+                    *(next - 1) > start) {
+                stop = *(next - 1);
+            }
+            HOST_DATA header = static_cast<HOST_DATA>(stop - start);
+            if (!std::binary_search(m_starts.begin(), m_starts.end(),
+                    start)) {
+                header |= HOST_FRAMED_CONTINUE;
+            }
+            uint16_t crc = UpdateCrc(HOST_CRC_INIT, header);
+            m_frames.push_back(HOST_FRAMED_SYNC);
+            m_frames.push_back(header);
+            for (; start < stop; ++start) {
+                crc = UpdateCrc(crc, m_words[start]);
+                m_frames.push_back(m_words[start]);
+            }
+            m_frames.push_back(crc);
+        }
+        m_segments[i].words = NULL;
+        m_segments[i].count = m_frames.size() - first;
+    }
+    size_t start = 0;
+    for (size_t i = 0; i < m_segments.size(); ++i) {
+        m_segments[i].words = m_frames.data() + start;
+        start += m_segments[i].count;
+    }
+}
+
+} // namespace tbhb
@@ -0,0 +1,197 @@
+/*
+ * tbhb.h
+ *
+ * Host library for streaming commands to tbhb boards. Commands from
+ * firmware/src/host.h are encoded into a reusable word buffer, and each
+ * Flush() hands everything buffered to a Backend in one call: one
+ * SPI_IOC_MESSAGE ioctl for SpiDevBackend, or one write for FileBackend,
+ * which feeds the simulator in firmware/sim.
+ */
+
+#ifndef TBHB_H_
+#define TBHB_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <linux/spi/spidev.h>
+
+#include "host.h"
+
+namespace tbhb {
+
+// Format: 0xGGRR, or RGB565 on a panel of 3 channels, as in
+//  firmware/src/defs.h
+typedef uint16_t pixel_t;
+
+// Default clock of the host link (HOST_SPI_CLK in firmware/src/defs.h)
+const uint32_t HOST_SPI_HZ = 4000000;
+
+// Panel of a board, as built with CHANNELS, WIDTH and LINES in
+//  firmware/src/defs.h; the default is the 8x8 red and green panel
+struct Geometry {
+    // Throws std::invalid_argument for a panel the firmware cannot drive
+    explicit Geometry(unsigned channels = 2, size_t width = 8,
+            size_t lines = 8);
+
+    size_t FramePixels() const { return width * lines; }
+    // Pixels of a driver word, and driver words of a line of a bit-plane
+    //  (DRIVER_PIXELS and LINE_WORDS in firmware/src/defs.h)
+    size_t DriverPixels() const { return 16 / channels; }
+    size_t LineWords() const { return width / DriverPixels(); }
+
+    // Pixel of 8-bit channel levels, and the 8-bit level of channel c of
+    //  a pixel, widened the same way as PixelLevel in firmware/src/defs.h
+    pixel_t Pixel(unsigned red, unsigned green, unsigned blue = 0) const;
+    unsigned Level(pixel_t pixel, unsigned c) const;
+
+    unsigned channels;      // 2 for 0xGGRR pixels, or 3 for RGB565
+    size_t width;
+    size_t lines;
+};
+
+// Encode whole lines of pixels into bit-planes for Stream::Planes, bits
+//  planes per line for a profile of that bit depth (PROFILE_BITS in
+//  firmware/src/defs.h); planes holds count / geometry.width * bits *
+//  geometry.LineWords() words. Levels are those of the default gamma
+//  tables, see Stream::Table
+void EncodePlanes(const Geometry &geometry, const pixel_t *pixels,
+        size_t count, unsigned bits, HOST_DATA *planes);
+
+// Words to send, followed by an idle time on the link
+struct Segment {
+    const HOST_DATA *words;
+    size_t count;
+    unsigned delay_us;
+};
+
+class Backend {
+public:
+    virtual ~Backend() {}
+    // Send segments in order; throws std::system_error on failure
+    virtual void Transfer(const Segment *segments, size_t count) = 0;
+    // Clock in count words of HOST_NOP and return the words read from
+    //  MISO, or zeros if the backend cannot read
+    virtual void Receive(HOST_DATA *words, size_t count) = 0;
+};
+
+// Linux spidev device, e.g. /dev/spidev0.0
+class SpiDevBackend : public Backend {
+public:
+    explicit SpiDevBackend(const std::string &path,
+            uint32_t speed_hz = HOST_SPI_HZ);
+    virtual ~SpiDevBackend();
+    virtual void Transfer(const Segment *segments, size_t count);
+    virtual void Receive(HOST_DATA *words, size_t count);
+
+private:
+    SpiDevBackend(const SpiDevBackend &);
+    SpiDevBackend &operator=(const SpiDevBackend &);
+
+    void Submit();
+
+    int m_fd;
+    size_t m_max_bytes;     // Bytes per message allowed by the driver
+    size_t m_bytes;
+    std::vector<spi_ioc_transfer> m_transfers;
+};
+
+// File, FIFO or pipe; binary output is read by tbhb-sim -b, and text
+//  output keeps delays as 'wait' lines for tbhb-sim without -b
+class FileBackend : public Backend {
+public:
+    enum Format {
+        BINARY,
+        TEXT
+    };
+
+    // Write to an open file, which is not closed by the backend
+    explicit FileBackend(FILE *file, Format format = BINARY);
+    explicit FileBackend(const std::string &path, Format format = BINARY);
+    virtual ~FileBackend();
+    virtual void Transfer(const Segment *segments, size_t count);
+    virtual void Receive(HOST_DATA *words, size_t count);
+
+private:
+    FileBackend(const FileBackend &);
+    FileBackend &operator=(const FileBackend &);
+
+    FILE *m_file;
+    bool m_owned;
+    Format m_format;
+    std::vector<uint8_t> m_bytes;
+};
+
+class Stream {
+public:
+    explicit Stream(Backend &backend, const Geometry &geometry = Geometry(),
+            size_t capacity = 1024);
+
+    // Board that following commands are sent to, or HOST_ID_ALL
+    void Target(uintptr_t id) { m_target = id & HOST_ID_MASK; }
+    // Send commands in frames with a CRC, for boards built with
+    //  HOST_FRAMED (see HOST_FRAMED_SYNC)
+    void Framed(bool framed) { m_framed = framed; }
+
+    void Nop();
+    // Give the board with /EN asserted the ID of the current target
+    void AssignId();
+    void Flip();
+    void Blank(enum HOST_COMMAND_BLANK blank);
+    void IRef(uintptr_t level);
+    void Fill(pixel_t pixel);
+    void Set(enum HOST_SETTING setting, uintptr_t value);
+    // One field of a segment rendered by the board (see HOST_WIDGET)
+    void Widget(uintptr_t segment, enum HOST_WIDGET_FIELD field,
+            uintptr_t value);
+    // Calibration table entries of a channel from the first one, 256 for
+    //  a gamma table or Geometry::FramePixels() for a scale table (see
+    //  HOST_TABLE)
+    void Table(enum HOST_TABLE_ID table, uintptr_t channel,
+            const uint16_t *values, size_t count);
+    void Frame(const pixel_t *pixels, size_t count);
+    // One frame per board in ID order, starting at ID 1; a board without
+    //  an ID takes the first one. Ignores the current target
+    void Broadcast(const pixel_t *pixels, size_t boards);
+    void Rect(uintptr_t x, uintptr_t y, uintptr_t width, uintptr_t height,
+            const pixel_t *pixels);
+    void Packed(enum HOST_PACKED_FORMAT format, const pixel_t *palette,
+            size_t colors, const HOST_DATA *words, size_t count);
+    // Lines encoded by EncodePlanes, with per_line planes each
+    void Planes(const HOST_DATA *planes, size_t count, unsigned per_line);
+
+    // Send everything buffered and read the status of the current target
+    //  (see HOST_STATUS); false if no board answered
+    bool Status(HOST_DATA status[HOST_STATUS_WORDS]);
+    // Same for the cycles a section of the firmware takes, on boards built
+    //  with CYCLE_STATS (see HOST_STATUS_CYCLES)
+    bool Cycles(enum HOST_CYCLES_SECTION section,
+            HOST_DATA status[HOST_STATUS_WORDS]);
+
+    // Keep the link idle after the commands so far, e.g. after Flip()
+    void Wait(unsigned us);
+    // Send all buffered commands to the backend
+    void Flush();
+    size_t Pending() const { return m_words.size(); }
+
+private:
+    void Command(enum HOST_COMMAND command);
+    void Variable(enum HOST_COMMAND command, size_t length);
+    void FrameSegments();
+
+    Backend &m_backend;
+    Geometry m_geometry;
+    uintptr_t m_target;
+    bool m_framed;
+    std::vector<HOST_DATA> m_words;
+    std::vector<Segment> m_segments;    // Ends of segments in m_words
+    std::vector<size_t> m_starts;       // Commands in m_words
+    std::vector<HOST_DATA> m_frames;    // m_words framed for HOST_FRAMED
+};
+
+} // namespace tbhb
+
+#endif /* TBHB_H_ */